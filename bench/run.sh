@@ -0,0 +1,70 @@
+#!/bin/sh
+# Benchmarks. Builds the interpreter and times every bench/*.spell, or the
+# workloads named on the command line, printing the best wall-clock time of
+# $RUNS runs (5 by default). A workload lists what to time it with in its
+# header: each "# bench: <arguments>" line is one run, with the arguments
+# passed to the program as Arguments, and "# ops: <n>" gives the operations
+# a run performs, for a rate and a time per operation. With --against, the
+# interpreter as of a git revision is built and timed too, on the line
+# after, to measure a change against the tree before it.
+#
+#     bench/run.sh [--against <revision>] [bench/<name>.spell ...]
+set -u
+cd "$(dirname "$0")/.."
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+runs=${RUNS:-5}
+
+against=
+if [ "${1:-}" = --against ]; then
+    against=$2
+    shift 2
+    git show "$against:spelllang_interpreter.cpp" > "$work/against.cpp" || exit 1
+    g++ -std=c++17 -O2 -pthread -I. "$work/against.cpp" -o "$work/against" || exit 1
+fi
+g++ -std=c++17 -O2 -pthread spelllang_interpreter.cpp -o "$work/spell" || exit 1
+
+# Prints the best time of $runs runs of the arguments, in nanoseconds, or
+# nothing if a run failed.
+best() {
+    fastest=
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        start=$(date +%s%N)
+        "$@" < /dev/null > /dev/null 2>&1 || return
+        elapsed=$(($(date +%s%N) - start))
+        if [ -z "$fastest" ] || [ "$elapsed" -lt "$fastest" ]; then fastest=$elapsed; fi
+        i=$((i + 1))
+    done
+    echo "$fastest"
+}
+
+report() {
+    if [ -z "$2" ]; then
+        printf '%-36s failed\n' "$1"
+        return
+    fi
+    line=$(awk -v ns="$2" 'BEGIN { printf "%9.3f s", ns / 1e9 }')
+    if [ -n "$ops" ]; then
+        line="$line$(awk -v ns="$2" -v ops="$ops" 'BEGIN { printf "  %9.3f M ops/s  %9.1f ns/op", ops * 1e3 / ns, ns / ops }')"
+    fi
+    printf '%-36s %s\n' "$1" "$line"
+}
+
+[ "$#" -gt 0 ] || set -- bench/*.spell
+echo "$(nproc) cores, best of $runs runs"
+for program in "$@"; do
+    name=$(basename "$program" .spell)
+    ops=$(sed -n 's/^# ops: *//p' "$program" | head -n 1)
+    if grep -q '^# bench:' "$program"; then
+        sed -n 's/^# bench: *//p' "$program" > "$work/arguments"
+        while read -r arguments; do
+            # Unquoted: the arguments are split into words.
+            report "$name $arguments" "$(best "$work/spell" "$program" $arguments)"
+            [ -z "$against" ] || report "  @$against" "$(best "$work/against" "$program" $arguments)"
+        done < "$work/arguments"
+    else
+        report "$name" "$(best "$work/spell" "$program")"
+        [ -z "$against" ] || report "  @$against" "$(best "$work/against" "$program")"
+    fi
+done
@@ -0,0 +1,93 @@
+// spelllang_client.cpp
+//
+// Thin client for `spelllang_interpreter --serve <socket>`. Runs a script in
+// the daemon as if the interpreter had been started on it: the script prints
+// to this process's stdout and stderr, which are handed to the daemon, and
+// the daemon's exit status becomes this process's.
+//
+//     g++ -std=c++17 -O2 -static spelllang_client.cpp -o spelllang_client
+//     ./spelllang_client <socket> [--ordered-output] <filename.spell> [arguments...]
+//
+// A request is stdout and stderr as descriptors, then a 32-bit length and
+// NUL-terminated fields: "1" for ordered output or "0", the script's
+// absolute path, and its arguments. The reply is one byte, the exit status.
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]) {
+    bool ordered = argc >= 4 && std::strcmp(argv[2], "--ordered-output") == 0;
+    int sourceIndex = ordered ? 3 : 2;
+    if (argc <= sourceIndex) {
+        std::fprintf(stderr, "Usage: ./spelllang_client <socket> [--ordered-output] <filename.spell> [arguments...]\n");
+        return 1;
+    }
+
+    // The daemon runs elsewhere, so the path must not depend on this directory.
+    char script[PATH_MAX];
+    if (!realpath(argv[sourceIndex], script)) {
+        std::fprintf(stderr, "Error: Cannot open file '%s'.\n", argv[sourceIndex]);
+        return 1;
+    }
+    std::string payload = ordered ? "1" : "0";
+    payload += '\0';
+    payload += script;
+    payload += '\0';
+    for (int i = sourceIndex + 1; i < argc; ++i) {
+        payload += argv[i];
+        payload += '\0';
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(argv[1]) >= sizeof(address.sun_path)) {
+        std::fprintf(stderr, "Error: Socket path '%s' is too long.\n", argv[1]);
+        return 1;
+    }
+    std::strcpy(address.sun_path, argv[1]);
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::fprintf(stderr, "Error: Cannot connect to '%s': %s\n", argv[1], std::strerror(errno));
+        return 1;
+    }
+
+    uint32_t length = static_cast<uint32_t>(payload.size());
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    iovec io{&length, sizeof(length)};
+    msghdr header{};
+    header.msg_iov = &io;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    cmsghdr* rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(rights), fds, sizeof(fds));
+    if (sendmsg(connection, &header, MSG_NOSIGNAL) != sizeof(length) ||
+        send(connection, payload.data(), payload.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(payload.size())) {
+        std::fprintf(stderr, "Error: Cannot send the request: %s\n", std::strerror(errno));
+        return 1;
+    }
+
+    uint8_t status;
+    ssize_t received;
+    do {
+        received = recv(connection, &status, 1, 0);
+    } while (received < 0 && errno == EINTR);
+    if (received != 1) {
+        std::fprintf(stderr, "Error: The daemon closed the connection.\n");
+        return 1;
+    }
+    return status;
+}
@@ -4,17 +4,181 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <cctype>
 #include <stdexcept>
 #include <functional>
+#include <array>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <cstdio>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+
+#ifdef SPELL_POINTER_COMPRESSION
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+// ======================== Parallel Work ========================
+
+// Runs work(i, worker) for every i in [0, count) on up to 'workers' threads,
+// handing out indexes in order. 'worker' identifies the calling thread, for
+// per-thread state. Returns once all work is done.
+template <typename Work>
+void parallelFor(size_t count, unsigned workers, Work work) {
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (unsigned worker = 0; worker < std::min<size_t>(workers, count); ++worker) {
+        threads.emplace_back([&, worker] {
+            for (size_t i = next++; i < count; i = next++) work(i, worker);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+// Like parallelFor, but each thread starts on a contiguous share of the
+// indexes and takes them from the front; a thread that runs out steals the
+// back half of another's remaining share. Neighbouring indexes mostly run on
+// the same thread, and uneven work still spreads over all of them. A single
+// worker runs on the calling thread.
+template <typename Work>
+void stealingFor(size_t count, unsigned workers, Work work) {
+    workers = static_cast<unsigned>(std::min<size_t>(workers, count));
+    if (workers == 0) return;
+    if (workers == 1) {
+        for (size_t i = 0; i < count; ++i) work(i, 0);
+        return;
+    }
+    // A share is [begin, end) in one word, so a take or a steal is one CAS.
+    struct alignas(64) Share {
+        std::atomic<uint64_t> range;
+    };
+    auto pack = [](uint64_t begin, uint64_t end) { return begin << 32 | end; };
+    std::vector<Share> shares(workers);
+    for (unsigned worker = 0; worker < workers; ++worker) {
+        shares[worker].range.store(pack(count * worker / workers, count * (worker + 1) / workers));
+    }
+    auto take = [&](Share& share, size_t& index) {
+        uint64_t range = share.range.load();
+        for (;;) {
+            uint64_t begin = range >> 32, end = range & 0xffffffff;
+            if (begin >= end) return false;
+            if (share.range.compare_exchange_weak(range, pack(begin + 1, end))) {
+                index = begin;
+                return true;
+            }
+        }
+    };
+    auto steal = [&](unsigned thief) {
+        for (unsigned i = 1; i < workers; ++i) {
+            Share& victim = shares[(thief + i) % workers];
+            uint64_t range = victim.range.load();
+            for (;;) {
+                uint64_t begin = range >> 32, end = range & 0xffffffff;
+                if (begin >= end) break;
+                uint64_t middle = begin + (end - begin) / 2;
+                if (victim.range.compare_exchange_weak(range, pack(begin, middle))) {
+                    shares[thief].range.store(pack(middle, end));
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    std::vector<std::thread> threads;
+    for (unsigned worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&, worker] {
+            size_t index;
+            do {
+                while (take(shares[worker], index)) work(index, worker);
+            } while (steal(worker));
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+// Sleeps while 'word' still holds 'expected'; may also return spuriously.
+// Without futexes this degrades to yielding.
+inline void futexWait(std::atomic<uint32_t>& word, uint32_t expected) {
+#ifdef __linux__
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32-bit words");
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    if (word.load() == expected) std::this_thread::yield();
+#endif
+}
+
+inline void futexWake(std::atomic<uint32_t>& word, int count) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+    (void)word;
+    (void)count;
+#endif
+}
+
+// A point threads wait at until another thread changes what they wait for.
+// A waiter registers, then checks its condition once more before sleeping on
+// the signal count it saw; a signaller that changed the condition bumps the
+// count and wakes only when someone is registered. The fences make each side
+// see the other's change, so no wakeup is lost.
+class WaitPoint {
+public:
+    // The state to pass to wait(), taken before checking the condition again.
+    uint32_t prepare() {
+        waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return signals.load(std::memory_order_relaxed);
+    }
+
+    void wait(uint32_t seen) {
+        futexWait(signals, seen);
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // For a waiter that found its condition met after prepare().
+    void cancel() {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void signal(int count = 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0) return;
+        signals.fetch_add(1, std::memory_order_relaxed);
+        futexWake(signals, count);
+    }
+
+private:
+    std::atomic<uint32_t> signals{0};
+    std::atomic<uint32_t> waiters{0};
+};
 
 // ======================== Token Definitions ========================
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     KEYWORD,
     IDENTIFIER,
     NUMBER,
@@ -24,26 +188,268 @@ enum class TokenType {
     EOF_TOKEN
 };
 
+// A packed 12-byte token: its type, a subkind, and its span in the source.
+// The text is not stored; TokenList::text reads it back from the source, or
+// from the literal table for literals whose value differs from their spelling.
 struct Token {
     TokenType type;
-    std::string value;
+    // KEYWORD: index in keywords(). STRING and NUMBER: kCooked when the value
+    // lives in the literal table.
+    uint8_t subkind;
+    // Byte offset of the token's first character, and its length in bytes.
+    uint32_t offset;
+    uint32_t length;
+
+    static constexpr uint8_t kCooked = 1;
+
+    Token(TokenType type = TokenType::EOF_TOKEN, uint8_t subkind = 0, uint32_t offset = 0, uint32_t length = 0)
+        : type(type), subkind(subkind), offset(offset), length(length) {}
+};
+
+static_assert(sizeof(Token) == 12, "Token must stay packed");
+
+inline const std::vector<std::string>& keywords() {
+    static const std::vector<std::string> table = {
+        "Wand", "Incantation", "Cast", "Illuminate", "Ifar", "Elsear",
+        "Loopus", "Persistus", "Cauldron", "SpellBooks", "Protego",
+        "Alohomora", "Magical", "Creature", "Bloodline", "Forar",
+        "in", "len", "str", "int"
+    };
+    return table;
+}
+
+inline uint8_t keywordId(std::string_view word) {
+    const auto& table = keywords();
+    return static_cast<uint8_t>(std::find(table.begin(), table.end(), word) - table.begin());
+}
+
+// The lexer's output: the tokens, the source they point into, and the
+// decoded values of escaped strings and non-decimal numbers, by offset.
+class TokenList {
+public:
+    // The source the tokens point into, and its owner unless the list only
+    // borrows it.
+    std::shared_ptr<const std::string> owner;
+    std::string_view source;
+    std::vector<Token> tokens;
+    std::unordered_map<uint32_t, std::string> literals;
+
+    size_t size() const { return tokens.size(); }
+    const Token& operator[](size_t i) const { return tokens[i]; }
+    const Token& back() const { return tokens.back(); }
+
+    // A string token's text is its contents without the quotes; a number
+    // token's is its decimal spelling.
+    std::string_view text(const Token& token) const {
+        if (token.subkind == Token::kCooked && (token.type == TokenType::STRING || token.type == TokenType::NUMBER)) {
+            return literals.at(token.offset);
+        }
+        std::string_view span(source.data() + token.offset, token.length);
+        if (token.type == TokenType::STRING) return span.substr(1, span.size() - 2);
+        return span;
+    }
+};
+
+struct SourcePosition {
     int line;
     int column;
+};
+
+// Maps byte offsets back to 1-based lines and columns. Tokens and nodes only
+// carry offsets; an index is built when a diagnostic needs a position, and
+// each lookup is a binary search over the line starts.
+class LineIndex {
+public:
+    explicit LineIndex(std::string_view source) {
+        lineStarts.push_back(0);
+        for (size_t i = 0; i < source.size(); ++i) {
+            if (source[i] == '\n') lineStarts.push_back(static_cast<uint32_t>(i + 1));
+        }
+    }
+
+    SourcePosition locate(uint32_t offset) const {
+        auto next = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+        int line = static_cast<int>(next - lineStarts.begin());
+        return {line, static_cast<int>(offset - *(next - 1)) + 1};
+    }
+
+    // "line L, column C", as diagnostics spell a position.
+    std::string describe(uint32_t offset) const {
+        SourcePosition position = locate(offset);
+        return "line " + std::to_string(position.line) + ", column " + std::to_string(position.column);
+    }
+
+private:
+    std::vector<uint32_t> lineStarts;
+};
 
-    Token(TokenType type = TokenType::EOF_TOKEN, const std::string& value = "", int line = 0, int column = 0)
-        : type(type), value(value), line(line), column(column) {}
+// A lexing or parsing error, with the byte offset it was found at.
+class SyntaxError : public std::runtime_error {
+public:
+    uint32_t offset;
+    SyntaxError(const std::string& message, uint32_t offset) : std::runtime_error(message), offset(offset) {}
 };
 
 // ======================== Lexer Implementation ========================
 
 class Lexer {
 public:
-    Lexer(const std::string& input)
-        : input(input), pos(0), line(1), column(1) {}
+    // Inputs at least this large are lexed in parallel chunks.
+    static constexpr size_t kParallelThreshold = size_t(1) << 20;
+    static constexpr size_t kMinChunk = size_t(256) << 10;
 
-    std::vector<Token> tokenize() {
-        std::vector<Token> tokens;
-        while (pos < input.size()) {
+    Lexer(const std::string& source)
+        : owned(std::make_shared<const std::string>(source)), input(*owned), pos(0), end(owned->size()) {}
+
+    Lexer(const Lexer&) = delete;
+    Lexer& operator=(const Lexer&) = delete;
+
+    TokenList tokenize() {
+        if (input.size() > UINT32_MAX) {
+            throw std::runtime_error("Source exceeds the 4 GB limit.");
+        }
+        TokenList list;
+        unsigned workers = std::thread::hardware_concurrency();
+        if (input.size() < kParallelThreshold || workers < 2) {
+            lexRange(list);
+        }
+        else {
+            tokenizeParallel(list, workers);
+        }
+        list.tokens.emplace_back(TokenType::EOF_TOKEN, 0, static_cast<uint32_t>(input.size()), 0);
+        list.owner = owned;
+        list.source = input;
+        return list;
+    }
+
+    // Lexes the tokens starting in source[begin, end), for incremental
+    // reparsing. The list borrows 'source'; the last token may run past 'end'
+    // to finish a string or comment, and the EOF token marks where lexing
+    // stopped.
+    static TokenList tokenizeRange(std::string_view source, size_t begin, size_t end) {
+        Lexer lexer(source, begin, end);
+        TokenList list;
+        list.source = source;
+        lexer.lexRange(list);
+        list.tokens.emplace_back(TokenType::EOF_TOKEN, 0, static_cast<uint32_t>(lexer.pos), 0);
+        return list;
+    }
+
+private:
+    // What a newline can be inside of: strings and block comments span lines,
+    // every other token ends at one.
+    enum LexState { Code, BlockComment, DoubleQuoted, SingleQuoted, kLexStates };
+
+    std::shared_ptr<const std::string> owned;
+    std::string_view input;
+    size_t pos;
+    size_t end;
+
+    // A lexer for input[begin, end) of a shared source. Offsets stay absolute.
+    Lexer(std::string_view input, size_t begin, size_t end)
+        : input(input), pos(begin), end(end) {}
+
+    // Splits the input after newlines into chunks, speculatively scans each
+    // chunk from every state to learn the state it ends in, then stitches the
+    // scans together in order to find each boundary's real state. Boundaries
+    // that fall inside a string or comment are dropped, so every remaining
+    // chunk starts in code and is lexed independently. The first error in
+    // source order wins, as it would sequentially.
+    void tokenizeParallel(TokenList& list, unsigned workers) {
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(workers * 4, input.size() / kMinChunk));
+        std::vector<size_t> bounds{0};
+        for (size_t i = 1; i < chunkCount; ++i) {
+            size_t newline = input.find('\n', std::max(bounds.back(), i * input.size() / chunkCount));
+            if (newline == std::string_view::npos) break;
+            if (newline + 1 < input.size()) bounds.push_back(newline + 1);
+        }
+        bounds.push_back(input.size());
+        size_t chunks = bounds.size() - 1;
+
+        std::vector<std::array<LexState, kLexStates>> transitions(chunks);
+        parallelFor(chunks, workers, [&](size_t i, unsigned) {
+            for (int state = 0; state < kLexStates; ++state) {
+                transitions[i][state] = scan(bounds[i], bounds[i + 1], static_cast<LexState>(state));
+            }
+        });
+
+        std::vector<size_t> starts;
+        LexState state = Code;
+        for (size_t i = 0; i < chunks; ++i) {
+            if (state == Code) starts.push_back(bounds[i]);
+            state = transitions[i][state];
+        }
+        starts.push_back(input.size());
+
+        size_t parts = starts.size() - 1;
+        std::vector<TokenList> results(parts);
+        std::vector<std::exception_ptr> errors(parts);
+        parallelFor(parts, workers, [&](size_t i, unsigned) {
+            try {
+                Lexer chunk(input, starts[i], starts[i + 1]);
+                chunk.lexRange(results[i]);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+        for (auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+        size_t total = 0;
+        for (auto& part : results) total += part.tokens.size();
+        list.tokens.reserve(total + 1);
+        for (auto& part : results) {
+            list.tokens.insert(list.tokens.end(), part.tokens.begin(), part.tokens.end());
+            list.literals.insert(part.literals.begin(), part.literals.end());
+        }
+    }
+
+    // The state the lexer is in at 'to' if it was in 'state' at 'from'. Only
+    // quotes, escapes, '#' and comment delimiters matter, so this is far
+    // cheaper than lexing.
+    LexState scan(size_t from, size_t to, LexState state) const {
+        for (size_t i = from; i < to; ++i) {
+            char c = input[i];
+            switch (state) {
+                case Code:
+                    if (c == '#') {
+                        size_t newline = input.find('\n', i);
+                        i = newline == std::string_view::npos ? to : newline;
+                    }
+                    else if (c == '/' && i + 1 < input.size() && input[i + 1] == '*') {
+                        state = BlockComment;
+                        ++i;
+                    }
+                    else if (c == '"') {
+                        state = DoubleQuoted;
+                    }
+                    else if (c == '\'') {
+                        state = SingleQuoted;
+                    }
+                    break;
+                case BlockComment:
+                    if (c == '*' && i + 1 < input.size() && input[i + 1] == '/') {
+                        state = Code;
+                        ++i;
+                    }
+                    break;
+                default:
+                    if (c == '\\') {
+                        ++i;
+                    }
+                    else if (c == (state == DoubleQuoted ? '"' : '\'')) {
+                        state = Code;
+                    }
+                    break;
+            }
+        }
+        return state;
+    }
+
+    void lexRange(TokenList& list) {
+        std::vector<Token>& tokens = list.tokens;
+        while (pos < end) {
             char current = peek();
             if (isspace(current)) {
                 consumeWhitespace();
@@ -62,11 +468,11 @@ public:
                 continue;
             }
             if (isdigit(current)) {
-                tokens.push_back(consumeNumber());
+                tokens.push_back(consumeNumber(list));
                 continue;
             }
             if (current == '"' || current == '\'') {
-                tokens.push_back(consumeString());
+                tokens.push_back(consumeString(list));
                 continue;
             }
             if (isOperatorStart(current)) {
@@ -74,21 +480,21 @@ public:
                 continue;
             }
             if (isDelimiter(current)) {
-                tokens.emplace_back(TokenType::DELIMITER, std::string(1, current), line, column);
+                tokens.emplace_back(TokenType::DELIMITER, 0, offset(), 1);
                 advance();
                 continue;
             }
-            throw std::runtime_error("Unknown character at line " + std::to_string(line) + ", column " + std::to_string(column));
+            throw SyntaxError("Unknown character at " + describe(offset()), offset());
         }
-        tokens.emplace_back(TokenType::EOF_TOKEN, "", line, column);
-        return tokens;
     }
 
-private:
-    std::string input;
-    size_t pos;
-    int line;
-    int column;
+    uint32_t offset() const {
+        return static_cast<uint32_t>(pos);
+    }
+
+    std::string describe(uint32_t offset) const {
+        return LineIndex(input).describe(offset);
+    }
 
     char peek() const {
         if (pos < input.size())
@@ -104,13 +510,6 @@ private:
 
     void advance() {
         if (pos < input.size()) {
-            if (input[pos] == '\n') {
-                line++;
-                column = 1;
-            }
-            else {
-                column++;
-            }
             pos++;
         }
     }
@@ -141,33 +540,64 @@ private:
     }
 
     Token consumeIdentifierOrKeyword() {
-        int startLine = line;
-        int startColumn = column;
-        std::string value;
+        uint32_t start = offset();
         while (pos < input.size() && (isalnum(peek()) || peek() == '_')) {
-            value += peek();
             advance();
         }
-        if (isKeyword(value)) {
-            return Token(TokenType::KEYWORD, value, startLine, startColumn);
+        std::string_view word(input.data() + start, offset() - start);
+        const auto& table = keywords();
+        auto keyword = std::find(table.begin(), table.end(), word);
+        if (keyword != table.end()) {
+            return Token(TokenType::KEYWORD, static_cast<uint8_t>(keyword - table.begin()), start, offset() - start);
         }
-        return Token(TokenType::IDENTIFIER, value, startLine, startColumn);
+        return Token(TokenType::IDENTIFIER, 0, start, offset() - start);
     }
 
-    Token consumeNumber() {
-        int startLine = line;
-        int startColumn = column;
-        std::string value;
-        while (pos < input.size() && isdigit(peek())) {
-            value += peek();
+    // Decimal, 0x hexadecimal or 0b binary digits, optionally grouped with
+    // single '_' separators. Anything but plain decimal digits records its
+    // decimal spelling in the literal table.
+    Token consumeNumber(TokenList& list) {
+        uint32_t start = offset();
+        int base = 10;
+        if (peek() == '0' && (tolower(peekNext()) == 'x' || tolower(peekNext()) == 'b')) {
+            base = tolower(peekNext()) == 'x' ? 16 : 2;
             advance();
+            advance();
+        }
+        std::string digits;
+        bool separator = false;
+        while (pos < input.size() && (isalnum(peek()) || peek() == '_')) {
+            if (peek() == '_') {
+                if (digits.empty() || separator) break;
+                separator = true;
+            }
+            else {
+                digits += peek();
+                separator = false;
+            }
+            advance();
+        }
+        long long value = 0;
+        auto result = std::from_chars(digits.data(), digits.data() + digits.size(), value, base);
+        if (result.ec == std::errc::result_out_of_range) {
+            throw SyntaxError("Number literal out of range at " + describe(start), start);
         }
-        return Token(TokenType::NUMBER, value, startLine, startColumn);
+        if (digits.empty() || separator || result.ec != std::errc() || result.ptr != digits.data() + digits.size()) {
+            throw SyntaxError("Malformed number literal at " + describe(start), start);
+        }
+        uint32_t length = offset() - start;
+        if (base == 10 && digits.size() == length) {
+            return Token(TokenType::NUMBER, 0, start, length);
+        }
+        char buffer[24];
+        char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+        list.literals[start].assign(buffer, end);
+        return Token(TokenType::NUMBER, Token::kCooked, start, length);
     }
 
-    Token consumeString() {
-        int startLine = line;
-        int startColumn = column;
+    // Strings with escapes record their decoded value in the literal table.
+    Token consumeString(TokenList& list) {
+        uint32_t start = offset();
         char quoteType = peek();
         std::string value;
         advance(); // consume opening quote
@@ -193,21 +623,22 @@ private:
         if (peek() == quoteType)
             advance(); // consume closing quote
         else
-            throw std::runtime_error("Unterminated string at line " + std::to_string(startLine) + ", column " + std::to_string(startColumn));
-        return Token(TokenType::STRING, value, startLine, startColumn);
+            throw SyntaxError("Unterminated string at " + describe(start), start);
+        uint32_t length = offset() - start;
+        if (value.size() == length - 2) {
+            return Token(TokenType::STRING, 0, start, length);
+        }
+        list.literals[start] = std::move(value);
+        return Token(TokenType::STRING, Token::kCooked, start, length);
     }
 
     Token consumeOperator() {
-        int startLine = line;
-        int startColumn = column;
-        std::string op;
-        op += peek();
+        uint32_t start = offset();
         if (isOperator(peek(), peekNext())) {
-            op += peekNext();
             advance();
         }
         advance();
-        return Token(TokenType::OPERATOR, op, startLine, startColumn);
+        return Token(TokenType::OPERATOR, 0, start, offset() - start);
     }
 
     bool isOperatorStart(char c) const {
@@ -227,33 +658,201 @@ private:
         std::string delimiters = "(){},.;[]";
         return delimiters.find(c) != std::string::npos;
     }
-
-    bool isKeyword(const std::string& word) const {
-        static const std::vector<std::string> keywords = {
-            "Wand", "Incantation", "Cast", "Illuminate", "Ifar", "Elsear",
-            "Loopus", "Persistus", "Cauldron", "SpellBooks", "Protego",
-            "Alohomora", "Magical", "Creature", "Bloodline", "Forar",
-            "in", "len", "str", "int"
-        };
-        return std::find(keywords.begin(), keywords.end(), word) != keywords.end();
-    }
 };
 
 // ======================== AST Definitions ========================
 
+// Scope requirement of a block, filled in by the EscapeAnalyzer. Blocks default
+// to Heap, which is always safe.
+enum class ScopeKind {
+    None,   // declares nothing: runs directly in the enclosing scope
+    Frame,  // declarations never escape: scope lives on the interpreter's stack
+    Heap    // may outlive the block: shared Environment
+};
+
 class ASTNode {
 public:
-    int line;
-    int column;
-    ASTNode(int line = 0, int column = 0) : line(line), column(column) {}
+    // Byte offset in the source; see LineIndex.
+    uint32_t offset;
+    ASTNode(uint32_t offset = 0) : offset(offset) {}
     virtual ~ASTNode() = default;
 };
 
 using ASTNodePtr = std::shared_ptr<ASTNode>;
 
+// Bump allocator for the nodes of one parse. Nodes are allocated with
+// std::allocate_shared through an AstAllocator, whose copy in each control
+// block keeps the arena alive until the last node built in it is gone.
+// An arena is filled by a single thread.
+class AstArena {
+public:
+    static constexpr size_t kBlockSize = size_t(64) << 10;
+
+    void* allocate(size_t size, size_t alignment) {
+        size_t start = (used + alignment - 1) & ~(alignment - 1);
+        if (blocks.empty() || start + size > capacity) {
+            capacity = std::max(kBlockSize, size + alignment);
+            blocks.push_back(std::make_unique<char[]>(capacity));
+            start = (reinterpret_cast<uintptr_t>(blocks.back().get()) + alignment - 1) & ~(alignment - 1);
+            start -= reinterpret_cast<uintptr_t>(blocks.back().get());
+        }
+        used = start + size;
+        return blocks.back().get() + start;
+    }
+
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t used = 0;
+    size_t capacity = 0;
+};
+
+template <typename T>
+class AstAllocator {
+public:
+    using value_type = T;
+    std::shared_ptr<AstArena> arena;
+
+    explicit AstAllocator(std::shared_ptr<AstArena> arena) : arena(std::move(arena)) {}
+    template <typename U>
+    AstAllocator(const AstAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // Memory is released with the whole arena.
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const AstAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const AstAllocator<U>& other) const { return arena != other.arena; }
+};
+
+struct DispatchTable;
+
+// An interned name. Equal names share one pointer within a SymbolTable, so
+// scopes compare names by address instead of by content.
+using Symbol = const std::string*;
+
+// The names of one Program or Document, freed with it. The names the
+// interpreter itself looks up (the builtins, 'error' and 'Arguments') are
+// interned once for the process and shared by every table. The rest are
+// spread over shards with a lock each, and every thread remembers the names
+// it has interned into the table in scope, so parser threads only take a
+// lock on a name's first use.
+class SymbolTable {
+public:
+    SymbolTable() : id(nextId().fetch_add(1, std::memory_order_relaxed)) {}
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    Symbol intern(std::string_view name) {
+        if (Symbol symbol = fixed(name)) return symbol;
+        Memo& memo = threadMemo();
+        if (memo.table != id) {
+            memo.names.clear();
+            memo.table = id;
+        }
+        auto found = memo.names.find(name);
+        if (found != memo.names.end()) return found->second;
+        Shard& shard = shards[std::hash<std::string_view>()(name) % kShards];
+        Symbol symbol;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            symbol = &*shard.names.emplace(name).first;
+        }
+        memo.names.emplace(*symbol, symbol);
+        return symbol;
+    }
+
+    // The process's Symbol for 'name', or null if it has none.
+    static Symbol fixed(std::string_view name) {
+        static const std::vector<std::string> names = {
+            "len", "str", "int", "Channel", "Pipe", "Send", "Transfer", "Receive", "Close", "Summon", "Await",
+            "SharedSpellBook", "Inscribe", "Increment", "Keys", "error", "Arguments"};
+        static const std::unordered_map<std::string_view, Symbol> symbols = [] {
+            std::unordered_map<std::string_view, Symbol> symbols;
+            for (auto& name : names) symbols.emplace(name, &name);
+            return symbols;
+        }();
+        auto found = symbols.find(name);
+        return found == symbols.end() ? nullptr : found->second;
+    }
+
+    // The table intern() uses on this thread.
+    static SymbolTable*& current() {
+        static thread_local SymbolTable* table = nullptr;
+        return table;
+    }
+
+    // Makes a table current for the lifetime of the scope.
+    class Scope {
+    public:
+        explicit Scope(SymbolTable& table) : previous(current()) { current() = &table; }
+        ~Scope() {
+            current() = previous;
+            if (!previous) threadMemo().names.clear();
+        }
+    private:
+        SymbolTable* previous;
+    };
+
+private:
+    static constexpr size_t kShards = 16;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_set<std::string> names;
+    };
+
+    // Tables are told apart by id rather than address, which a later table
+    // may reuse.
+    struct Memo {
+        uint64_t table = 0;
+        std::unordered_map<std::string_view, Symbol> names;
+    };
+
+    const uint64_t id;
+    Shard shards[kShards];
+
+    static std::atomic<uint64_t>& nextId() {
+        static std::atomic<uint64_t> next{1};
+        return next;
+    }
+
+    static Memo& threadMemo() {
+        static thread_local Memo memo;
+        return memo;
+    }
+};
+
+// Interns into the current table; see SymbolTable::Scope.
+inline Symbol intern(std::string_view name) {
+    if (SymbolTable* table = SymbolTable::current()) return table->intern(name);
+    if (Symbol symbol = SymbolTable::fixed(name)) return symbol;
+    throw std::logic_error("'" + std::string(name) + "' was interned outside a SymbolTable::Scope.");
+}
+
+inline std::vector<Symbol> internAll(const std::vector<std::string>& names) {
+    std::vector<Symbol> symbols;
+    symbols.reserve(names.size());
+    for (auto& name : names) symbols.push_back(intern(name));
+    return symbols;
+}
+
+// A parsed program. Once the analysis passes have annotated it, it is never
+// written again: interpreters take it as a const Program and walk it through
+// const references, and keep everything they change (scopes, heap, the
+// string literals they materialize) to themselves. One compiled program is
+// run by any number of interpreters at once, on any threads, without copies
+// or locks.
 class Program : public ASTNode {
 public:
     std::vector<ASTNodePtr> statements;
+    // The table the program's names were interned into. Batch mode interns
+    // record fields into it too, which is safe from any thread.
+    std::shared_ptr<SymbolTable> symbols;
     Program(const std::vector<ASTNodePtr>& stmts) : statements(stmts) {}
 };
 
@@ -261,55 +860,58 @@ class VarDeclaration : public ASTNode {
 public:
     std::string var_type;
     std::string name;
+    Symbol symbol;
     ASTNodePtr value;
-    VarDeclaration(const std::string& type, const std::string& name, ASTNodePtr value, int line, int column)
-        : var_type(type), name(name), value(value) {
-        this->line = line;
-        this->column = column;
+    VarDeclaration(const std::string& type, const std::string& name, ASTNodePtr value, uint32_t offset)
+        : var_type(type), name(name), symbol(intern(name)), value(value) {
+        this->offset = offset;
     }
 };
 
 class Assignment : public ASTNode {
 public:
     std::string name;
+    Symbol symbol;
     ASTNodePtr value;
-    Assignment(const std::string& name, ASTNodePtr value, int line, int column)
-        : name(name), value(value) {
-        this->line = line;
-        this->column = column;
+    Assignment(const std::string& name, ASTNodePtr value, uint32_t offset)
+        : name(name), symbol(intern(name)), value(value) {
+        this->offset = offset;
     }
 };
 
 class FunctionDeclaration : public ASTNode {
 public:
     std::string name;
+    Symbol symbol;
     std::vector<std::string> params;
+    std::vector<Symbol> paramSymbols;
     std::vector<ASTNodePtr> body;
-    FunctionDeclaration(const std::string& name, const std::vector<std::string>& params, const std::vector<ASTNodePtr>& body, int line, int column)
-        : name(name), params(params), body(body) {
-        this->line = line;
-        this->column = column;
+    // Variables of enclosing non-global scopes the body refers to, filled in by the UpvalueResolver.
+    std::vector<std::string> upvalues;
+    std::vector<Symbol> upvalueSymbols;
+    FunctionDeclaration(const std::string& name, const std::vector<std::string>& params, const std::vector<ASTNodePtr>& body, uint32_t offset)
+        : name(name), symbol(intern(name)), params(params), paramSymbols(internAll(params)), body(body) {
+        this->offset = offset;
     }
 };
 
 class FunctionCall : public ASTNode {
 public:
     std::string name;
+    Symbol symbol;
     std::vector<ASTNodePtr> args;
-    FunctionCall(const std::string& name, const std::vector<ASTNodePtr>& args, int line, int column)
-        : name(name), args(args) {
-        this->line = line;
-        this->column = column;
+    FunctionCall(const std::string& name, const std::vector<ASTNodePtr>& args, uint32_t offset)
+        : name(name), symbol(intern(name)), args(args) {
+        this->offset = offset;
     }
 };
 
 class PrintStatement : public ASTNode {
 public:
     ASTNodePtr expression;
-    PrintStatement(ASTNodePtr expr, int line, int column)
+    PrintStatement(ASTNodePtr expr, uint32_t offset)
         : expression(expr) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
@@ -318,10 +920,13 @@ public:
     ASTNodePtr condition;
     std::vector<ASTNodePtr> if_body;
     std::vector<ASTNodePtr> else_body;
-    IfStatement(ASTNodePtr cond, const std::vector<ASTNodePtr>& if_b, const std::vector<ASTNodePtr>& else_b, int line, int column)
+    ScopeKind if_scope = ScopeKind::Heap;
+    ScopeKind else_scope = ScopeKind::Heap;
+    // Set by the DispatchCompiler on the head of a chain over constants.
+    std::shared_ptr<const DispatchTable> dispatch;
+    IfStatement(ASTNodePtr cond, const std::vector<ASTNodePtr>& if_b, const std::vector<ASTNodePtr>& else_b, uint32_t offset)
         : condition(cond), if_body(if_b), else_body(else_b) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
@@ -329,10 +934,10 @@ class WhileLoop : public ASTNode {
 public:
     ASTNodePtr condition;
     std::vector<ASTNodePtr> body;
-    WhileLoop(ASTNodePtr cond, const std::vector<ASTNodePtr>& body, int line, int column)
+    ScopeKind body_scope = ScopeKind::Heap;
+    WhileLoop(ASTNodePtr cond, const std::vector<ASTNodePtr>& body, uint32_t offset)
         : condition(cond), body(body) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
@@ -342,23 +947,57 @@ public:
     ASTNodePtr condition;
     ASTNodePtr increment;
     std::vector<ASTNodePtr> body;
-    ForLoop(ASTNodePtr init, ASTNodePtr cond, ASTNodePtr inc, const std::vector<ASTNodePtr>& body, int line, int column)
+    ScopeKind body_scope = ScopeKind::Heap;
+    // Set by the BoundsCheckEliminator when the condition's len() is loop-invariant.
+    bool invariant_bound = false;
+    ForLoop(ASTNodePtr init, ASTNodePtr cond, ASTNodePtr inc, const std::vector<ASTNodePtr>& body, uint32_t offset)
         : initialization(init), condition(cond), increment(inc), body(body) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
+    }
+};
+
+// A 'Gather' clause of a Forar: in a parallel loop each worker accumulates
+// into a private copy of the variable, and the copies are merged into it,
+// in iteration order, when the loop ends.
+struct Reduction {
+    enum class Kind { Sum, Min, Max, Concat };
+    Kind kind;
+    std::string name;
+    Symbol symbol;
+};
+
+class ForEachLoop : public ASTNode {
+public:
+    std::string name;
+    Symbol symbol;
+    ASTNodePtr items;
+    std::vector<ASTNodePtr> body;
+    // 'Forar Geminio' runs the iterations on worker isolates.
+    bool parallel;
+    std::vector<Reduction> reductions;
+    ScopeKind body_scope = ScopeKind::Heap;
+    // Variables from outside the loop the body refers to, filled in by the
+    // UpvalueResolver for a parallel loop, which copies them to its workers.
+    std::vector<std::string> shared;
+    std::vector<Symbol> sharedSymbols;
+    ForEachLoop(const std::string& name, ASTNodePtr items, const std::vector<ASTNodePtr>& body, bool parallel,
+                const std::vector<Reduction>& reductions, uint32_t offset)
+        : name(name), symbol(intern(name)), items(items), body(body), parallel(parallel), reductions(reductions) {
+        this->offset = offset;
     }
 };
 
 class ClassDeclaration : public ASTNode {
 public:
     std::string name;
+    Symbol symbol;
     std::vector<std::string> params;
+    std::vector<Symbol> paramSymbols;
     std::vector<ASTNodePtr> body;
     std::string parent;
-    ClassDeclaration(const std::string& name, const std::vector<std::string>& params, const std::vector<ASTNodePtr>& body, const std::string& parent, int line, int column)
-        : name(name), params(params), body(body), parent(parent) {
-        this->line = line;
-        this->column = column;
+    ClassDeclaration(const std::string& name, const std::vector<std::string>& params, const std::vector<ASTNodePtr>& body, const std::string& parent, uint32_t offset)
+        : name(name), symbol(intern(name)), params(params), paramSymbols(internAll(params)), body(body), parent(parent) {
+        this->offset = offset;
     }
 };
 
@@ -366,10 +1005,13 @@ class TryCatch : public ASTNode {
 public:
     std::vector<ASTNodePtr> try_block;
     std::vector<ASTNodePtr> catch_block;
-    TryCatch(const std::vector<ASTNodePtr>& try_b, const std::vector<ASTNodePtr>& catch_b, int line, int column)
-        : try_block(try_b), catch_block(catch_b) {
-        this->line = line;
-        this->column = column;
+    ScopeKind try_scope = ScopeKind::Heap;
+    ScopeKind catch_scope = ScopeKind::Heap;
+    // The variable the catch block receives the message in.
+    Symbol errorSymbol;
+    TryCatch(const std::vector<ASTNodePtr>& try_b, const std::vector<ASTNodePtr>& catch_b, uint32_t offset)
+        : try_block(try_b), catch_block(catch_b), errorSymbol(intern("error")) {
+        this->offset = offset;
     }
 };
 
@@ -378,10 +1020,9 @@ public:
     std::string op;
     ASTNodePtr left;
     ASTNodePtr right;
-    BinaryOp(const std::string& op, ASTNodePtr left, ASTNodePtr right, int line, int column)
+    BinaryOp(const std::string& op, ASTNodePtr left, ASTNodePtr right, uint32_t offset)
         : op(op), left(left), right(right) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
@@ -389,50 +1030,70 @@ class UnaryOp : public ASTNode {
 public:
     std::string op;
     ASTNodePtr operand;
-    UnaryOp(const std::string& op, ASTNodePtr operand, int line, int column)
+    UnaryOp(const std::string& op, ASTNodePtr operand, uint32_t offset)
         : op(op), operand(operand) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
 class Literal : public ASTNode {
 public:
     std::string value;
-    Literal(const std::string& value, int line, int column)
+    Literal(const std::string& value, uint32_t offset)
         : value(value) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
 class NumberLiteral : public ASTNode {
 public:
-    int value;
-    NumberLiteral(int value, int line, int column)
+    long long value;
+    NumberLiteral(long long value, uint32_t offset)
         : value(value) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
 class StringLiteral : public ASTNode {
 public:
     std::string value;
-    StringLiteral(const std::string& value, int line, int column)
+    StringLiteral(const std::string& value, uint32_t offset)
         : value(value) {
-        this->line = line;
-        this->column = column;
+        this->offset = offset;
     }
 };
 
 class Identifier : public ASTNode {
 public:
     std::string name;
-    Identifier(const std::string& name, int line, int column)
-        : name(name) {
-        this->line = line;
-        this->column = column;
+    Symbol symbol;
+    Identifier(const std::string& name, uint32_t offset)
+        : name(name), symbol(intern(name)) {
+        this->offset = offset;
+    }
+};
+
+class ListLiteral : public ASTNode {
+public:
+    std::vector<ASTNodePtr> elements;
+    // Set by the EscapeAnalyzer when the Cauldron never outlives its use: the
+    // interpreter then refills one Cauldron per site instead of allocating.
+    bool reusable = false;
+    ListLiteral(const std::vector<ASTNodePtr>& elements, uint32_t offset)
+        : elements(elements) {
+        this->offset = offset;
+    }
+};
+
+class IndexExpression : public ASTNode {
+public:
+    ASTNodePtr object;
+    ASTNodePtr index;
+    // Cleared by the BoundsCheckEliminator when the index is proven in range.
+    bool bounds_checked = true;
+    IndexExpression(ASTNodePtr object, ASTNodePtr index, uint32_t offset)
+        : object(object), index(index) {
+        this->offset = offset;
     }
 };
 
@@ -440,10 +1101,61 @@ public:
 
 class Parser {
 public:
-    Parser(const std::vector<Token>& tokens)
-        : tokens(tokens), pos(0) {}
+    // Token streams at least this long parse their top-level Incantations and
+    // Creatures in parallel.
+    static constexpr size_t kParallelThreshold = size_t(64) << 10;
+
+    Parser(const TokenList& tokens)
+        : tokens(tokens), pos(0), end(tokens.size() - 1), arena(std::make_shared<AstArena>()) {}
 
     std::shared_ptr<Program> parse() {
+        unsigned workers = std::thread::hardware_concurrency();
+        if (tokens.size() >= kParallelThreshold && workers >= 2) {
+            auto segments = topLevelSegments();
+            if (segments.size() >= 2) {
+                return std::make_shared<Program>(parseSegments(segments, workers));
+            }
+        }
+        return std::make_shared<Program>(parseStatements());
+    }
+
+    // Statement-at-a-time parsing over a whole token list, for incremental
+    // reparsing. Without an arena, nodes are allocated individually.
+    Parser(const TokenList& tokens, std::shared_ptr<AstArena> arena)
+        : Parser(tokens, 0, tokens.size() - 1, std::move(arena)) {}
+
+    bool done() const {
+        return isAtEnd();
+    }
+
+    // Index of the next token to parse.
+    size_t position() const {
+        return pos;
+    }
+
+    ASTNodePtr parseStatement() {
+        return statement();
+    }
+
+private:
+    const TokenList& tokens;
+    size_t pos;
+    // Index of the token that ends this parser's range: EOF, or the first
+    // token of the next segment.
+    size_t end;
+    std::shared_ptr<AstArena> arena;
+
+    // Parses tokens[begin, end) into 'arena'.
+    Parser(const TokenList& tokens, size_t begin, size_t end, std::shared_ptr<AstArena> arena)
+        : tokens(tokens), pos(begin), end(end), arena(std::move(arena)) {}
+
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+        if (!arena) return std::make_shared<T>(std::forward<Args>(args)...);
+        return std::allocate_shared<T>(AstAllocator<T>(arena), std::forward<Args>(args)...);
+    }
+
+    std::vector<ASTNodePtr> parseStatements() {
         std::vector<ASTNodePtr> statements;
         while (!isAtEnd()) {
             auto stmt = statement();
@@ -451,15 +1163,99 @@ public:
                 statements.push_back(stmt);
             }
         }
-        return std::make_shared<Program>(statements);
+        return statements;
     }
 
-private:
-    std::vector<Token> tokens;
-    size_t pos;
+    // Splits the top level into [begin, end) token ranges by brace matching:
+    // each Incantation or Magical Creature declaration is a segment of its
+    // own, running through its matching '}', and the statements between them
+    // form the segments in between.
+    std::vector<std::pair<size_t, size_t>> topLevelSegments() const {
+        static const uint8_t incantation = keywordId("Incantation");
+        static const uint8_t magical = keywordId("Magical");
+        std::vector<std::pair<size_t, size_t>> segments;
+        size_t groupStart = 0;
+        int depth = 0;
+        for (size_t i = 0; i < end; ++i) {
+            const Token& token = tokens[i];
+            if (token.type == TokenType::DELIMITER && token.length == 1) {
+                char c = tokens.source[token.offset];
+                if (c == '{') depth++;
+                else if (c == '}') depth--;
+                continue;
+            }
+            if (depth != 0 || token.type != TokenType::KEYWORD || (token.subkind != incantation && token.subkind != magical)) {
+                continue;
+            }
+            size_t close = matchingBrace(i);
+            if (close == end) break;
+            if (groupStart < i) segments.emplace_back(groupStart, i);
+            segments.emplace_back(i, close + 1);
+            groupStart = close + 1;
+            i = close;
+        }
+        if (groupStart < end) segments.emplace_back(groupStart, end);
+        return segments;
+    }
+
+    // The '}' closing the first block after 'from', or 'end' if there is none.
+    size_t matchingBrace(size_t from) const {
+        int depth = 0;
+        for (size_t i = from; i < end; ++i) {
+            const Token& token = tokens[i];
+            if (token.type != TokenType::DELIMITER || token.length != 1) continue;
+            char c = tokens.source[token.offset];
+            if (c == '{') {
+                depth++;
+            }
+            else if (c == '}' && --depth <= 0) {
+                return depth == 0 ? i : end;
+            }
+        }
+        return end;
+    }
+
+    // Parses every segment on the worker threads, each worker into its own
+    // arena, and concatenates the statements in source order. The error of
+    // the earliest failing segment is the one reported.
+    std::vector<ASTNodePtr> parseSegments(const std::vector<std::pair<size_t, size_t>>& segments, unsigned workers) {
+        std::vector<std::shared_ptr<AstArena>> arenas(workers);
+        for (auto& workerArena : arenas) workerArena = std::make_shared<AstArena>();
+        std::vector<std::vector<ASTNodePtr>> results(segments.size());
+        std::vector<std::exception_ptr> errors(segments.size());
+        SymbolTable& symbols = *SymbolTable::current();
+        parallelFor(segments.size(), workers, [&](size_t i, unsigned worker) {
+            try {
+                SymbolTable::Scope scope(symbols);
+                Parser segment(tokens, segments[i].first, segments[i].second, arenas[worker]);
+                results[i] = segment.parseStatements();
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+        for (auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+        std::vector<ASTNodePtr> statements;
+        for (auto& result : results) {
+            statements.insert(statements.end(), result.begin(), result.end());
+        }
+        return statements;
+    }
+    mutable std::unique_ptr<LineIndex> lineIndex;
+
+    const LineIndex& lines() const {
+        if (!lineIndex) lineIndex = std::make_unique<LineIndex>(tokens.source);
+        return *lineIndex;
+    }
+
+    std::string textOf(const Token& token) const {
+        return std::string(tokens.text(token));
+    }
 
     bool isAtEnd() const {
-        return peek().type == TokenType::EOF_TOKEN;
+        return pos >= end;
     }
 
     Token peek() const {
@@ -479,14 +1275,16 @@ private:
         return previous();
     }
 
-    bool check(TokenType type, const std::string& value = "") const {
+    bool check(TokenType type, std::string_view value = {}) const {
         if (isAtEnd()) return false;
-        if (tokens[pos].type != type) return false;
-        if (!value.empty() && tokens[pos].value != value) return false;
+        // Punctuation is lexed as DELIMITER but matched by the parser as OPERATOR.
+        bool punctuation = type == TokenType::OPERATOR && tokens[pos].type == TokenType::DELIMITER;
+        if (tokens[pos].type != type && !punctuation) return false;
+        if (!value.empty() && tokens.text(tokens[pos]) != value) return false;
         return true;
     }
 
-    bool match(TokenType type, const std::string& value = "") {
+    bool match(TokenType type, std::string_view value = {}) {
         if (check(type, value)) {
             advance();
             return true;
@@ -494,14 +1292,6 @@ private:
         return false;
     }
 
-    void consume(TokenType type, const std::string& value, const std::string& errorMessage) {
-        if (check(type, value)) {
-            advance();
-            return;
-        }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
-    }
-
     ASTNodePtr statement() {
         if (match(TokenType::KEYWORD, "Wand") ||
             match(TokenType::KEYWORD, "Cauldron") ||
@@ -526,6 +1316,9 @@ private:
         if (match(TokenType::KEYWORD, "Persistus")) {
             return whileLoop();
         }
+        if (match(TokenType::KEYWORD, "Forar")) {
+            return forEachLoop();
+        }
         if (match(TokenType::KEYWORD, "Protego")) {
             return tryCatch();
         }
@@ -535,7 +1328,7 @@ private:
         if (check(TokenType::IDENTIFIER)) {
             return assignment();
         }
-        throw std::runtime_error("Unexpected token '" + peek().value + "' at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column));
+        throw SyntaxError("Unexpected token '" + textOf(peek()) + "' at " + lines().describe(peek().offset), peek().offset);
     }
 
     ASTNodePtr variableDeclaration() {
@@ -543,14 +1336,14 @@ private:
         Token varName = consumeIdentifier("Expected variable name.");
         consume(TokenType::OPERATOR, "=", "Expected '=' after variable name.");
         ASTNodePtr value = expression();
-        return std::make_shared<VarDeclaration>(varType.value, varName.value, value, varType.line, varType.column);
+        return make<VarDeclaration>(textOf(varType), textOf(varName), value, varType.offset);
     }
 
     ASTNodePtr assignment() {
         Token varName = consume(TokenType::IDENTIFIER, "Expected variable name.");
         consume(TokenType::OPERATOR, "=", "Expected '=' after variable name.");
         ASTNodePtr value = expression();
-        return std::make_shared<Assignment>(varName.value, value, varName.line, varName.column);
+        return make<Assignment>(textOf(varName), value, varName.offset);
     }
 
     ASTNodePtr functionDeclaration() {
@@ -560,7 +1353,7 @@ private:
         if (!check(TokenType::OPERATOR, ")")) {
             do {
                 Token param = consume(TokenType::IDENTIFIER, "Expected parameter name.");
-                params.push_back(param.value);
+                params.push_back(textOf(param));
             } while (match(TokenType::OPERATOR, ","));
         }
         consume(TokenType::OPERATOR, ")", "Expected ')' after parameters.");
@@ -570,7 +1363,7 @@ private:
             body.push_back(statement());
         }
         consume(TokenType::OPERATOR, "}", "Expected '}' after function body.");
-        return std::make_shared<FunctionDeclaration>(funcName.value, params, body, funcName.line, funcName.column);
+        return make<FunctionDeclaration>(textOf(funcName), params, body, funcName.offset);
     }
 
     ASTNodePtr functionCallStatement() {
@@ -583,14 +1376,14 @@ private:
             } while (match(TokenType::OPERATOR, ","));
         }
         consume(TokenType::OPERATOR, ")", "Expected ')' after arguments.");
-        return std::make_shared<FunctionCall>(funcName.value, args, funcName.line, funcName.column);
+        return make<FunctionCall>(textOf(funcName), args, funcName.offset);
     }
 
     ASTNodePtr printStatement() {
         consume(TokenType::OPERATOR, "(", "Expected '(' after 'Illuminate'.");
         ASTNodePtr expr = expression();
         consume(TokenType::OPERATOR, ")", "Expected ')' after expression.");
-        return std::make_shared<PrintStatement>(expr, expr->line, expr->column);
+        return make<PrintStatement>(expr, expr->offset);
     }
 
     ASTNodePtr ifStatement() {
@@ -609,7 +1402,7 @@ private:
             }
             consume(TokenType::OPERATOR, "}", "Expected '}' after else body.");
         }
-        return std::make_shared<IfStatement>(condition, ifBody, elseBody, condition->line, condition->column);
+        return make<IfStatement>(condition, ifBody, elseBody, condition->offset);
     }
 
     ASTNodePtr whileLoop() {
@@ -620,39 +1413,101 @@ private:
             body.push_back(statement());
         }
         consume(TokenType::OPERATOR, "}", "Expected '}' after while loop body.");
-        return std::make_shared<WhileLoop>(condition, body, condition->line, condition->column);
+        return make<WhileLoop>(condition, body, condition->offset);
     }
 
     ASTNodePtr forLoop() {
-        ASTNodePtr initialization = expression();
-        consume(TokenType::OPERATOR, ";", "Expected ';' after initialization.");
+        ASTNodePtr initialization = forClause();
+        match(TokenType::OPERATOR, ";");
         ASTNodePtr condition = expression();
-        consume(TokenType::OPERATOR, ";", "Expected ';' after condition.");
-        ASTNodePtr increment = expression();
+        match(TokenType::OPERATOR, ";");
+        ASTNodePtr increment = forClause();
         consume(TokenType::OPERATOR, "{", "Expected '{' after for loop declaration.");
         std::vector<ASTNodePtr> body;
         while (!check(TokenType::OPERATOR, "}")) {
             body.push_back(statement());
         }
         consume(TokenType::OPERATOR, "}", "Expected '}' after for loop body.");
-        return std::make_shared<ForLoop>(initialization, condition, increment, body, initialization->line, initialization->column);
+        return make<ForLoop>(initialization, condition, increment, body, initialization->offset);
     }
 
-    ASTNodePtr tryCatch() {
-        consume(TokenType::OPERATOR, "{", "Expected '{' after 'Protego'.");
-        std::vector<ASTNodePtr> tryBlock;
-        while (!check(TokenType::OPERATOR, "}")) {
-            tryBlock.push_back(statement());
+    // Forar [Geminio] <name> in <Cauldron> [Gather <reduction> <variable>, ...] { ... }
+    //
+    // Geminio and Gather are ordinary names everywhere else: Geminio is only
+    // special when the loop variable follows it, Gather right after the
+    // Cauldron.
+    ASTNodePtr forEachLoop() {
+        Token keyword = previous();
+        bool parallel = check(TokenType::IDENTIFIER, "Geminio") && pos + 1 < end &&
+                        tokens[pos + 1].type == TokenType::IDENTIFIER;
+        if (parallel) advance();
+        Token varName = consumeIdentifier("Expected loop variable after 'Forar'.");
+        consume(TokenType::KEYWORD, "in", "Expected 'in' after loop variable.");
+        ASTNodePtr items = expression();
+        std::vector<Reduction> reductions;
+        if (match(TokenType::IDENTIFIER, "Gather")) {
+            do {
+                reductions.push_back(reduction(textOf(varName), reductions));
+            } while (match(TokenType::OPERATOR, ","));
         }
-        consume(TokenType::OPERATOR, "}", "Expected '}' after try block.");
-        consume(TokenType::KEYWORD, "Alohomora", "Expected 'Alohomora' after try block.");
-        consume(TokenType::OPERATOR, "{", "Expected '{' after 'Alohomora'.");
-        std::vector<ASTNodePtr> catchBlock;
+        consume(TokenType::OPERATOR, "{", "Expected '{' after Forar declaration.");
+        std::vector<ASTNodePtr> body;
         while (!check(TokenType::OPERATOR, "}")) {
-            catchBlock.push_back(statement());
+            body.push_back(statement());
         }
-        consume(TokenType::OPERATOR, "}", "Expected '}' after catch block.");
-        return std::make_shared<TryCatch>(tryBlock, catchBlock, tryBlock.empty() ? 0 : tryBlock[0]->line, tryBlock.empty() ? 0 : tryBlock[0]->column);
+        consume(TokenType::OPERATOR, "}", "Expected '}' after Forar body.");
+        return make<ForEachLoop>(textOf(varName), items, body, parallel, reductions, keyword.offset);
+    }
+
+    Reduction reduction(const std::string& loopVariable, const std::vector<Reduction>& earlier) {
+        Token kind = consumeIdentifier("Expected sum, min, max or concat after 'Gather'.");
+        std::string kindName = textOf(kind);
+        Reduction reduction;
+        if (kindName == "sum") reduction.kind = Reduction::Kind::Sum;
+        else if (kindName == "min") reduction.kind = Reduction::Kind::Min;
+        else if (kindName == "max") reduction.kind = Reduction::Kind::Max;
+        else if (kindName == "concat") reduction.kind = Reduction::Kind::Concat;
+        else throw SyntaxError("Parser Error at " + lines().describe(kind.offset) + ": Unknown reduction '" + kindName +
+                               "'. Expected sum, min, max or concat.", kind.offset);
+        Token variable = consumeIdentifier("Expected variable name after '" + kindName + "'.");
+        reduction.name = textOf(variable);
+        reduction.symbol = intern(reduction.name);
+        if (reduction.name == loopVariable) {
+            throw SyntaxError("Parser Error at " + lines().describe(variable.offset) + ": The loop variable '" +
+                              reduction.name + "' cannot be gathered.", variable.offset);
+        }
+        for (auto& other : earlier) {
+            if (other.symbol == reduction.symbol) {
+                throw SyntaxError("Parser Error at " + lines().describe(variable.offset) + ": '" + reduction.name +
+                                  "' is gathered twice.", variable.offset);
+            }
+        }
+        return reduction;
+    }
+
+    // Initialization and increment are usually assignments ('i = 0', 'i = i + 1').
+    ASTNodePtr forClause() {
+        if (check(TokenType::IDENTIFIER) && pos + 1 < tokens.size() && tokens.text(tokens[pos + 1]) == "=") {
+            return assignment();
+        }
+        return expression();
+    }
+
+    ASTNodePtr tryCatch() {
+        consume(TokenType::OPERATOR, "{", "Expected '{' after 'Protego'.");
+        std::vector<ASTNodePtr> tryBlock;
+        while (!check(TokenType::OPERATOR, "}")) {
+            tryBlock.push_back(statement());
+        }
+        consume(TokenType::OPERATOR, "}", "Expected '}' after try block.");
+        consume(TokenType::KEYWORD, "Alohomora", "Expected 'Alohomora' after try block.");
+        consume(TokenType::OPERATOR, "{", "Expected '{' after 'Alohomora'.");
+        std::vector<ASTNodePtr> catchBlock;
+        while (!check(TokenType::OPERATOR, "}")) {
+            catchBlock.push_back(statement());
+        }
+        consume(TokenType::OPERATOR, "}", "Expected '}' after catch block.");
+        return make<TryCatch>(tryBlock, catchBlock, tryBlock.empty() ? 0 : tryBlock[0]->offset);
     }
 
     ASTNodePtr classDeclaration() {
@@ -663,14 +1518,14 @@ private:
         if (!check(TokenType::OPERATOR, ")")) {
             do {
                 Token param = consume(TokenType::IDENTIFIER, "Expected parameter name.");
-                params.push_back(param.value);
+                params.push_back(textOf(param));
             } while (match(TokenType::OPERATOR, ","));
         }
         consume(TokenType::OPERATOR, ")", "Expected ')' after parameters.");
         std::string parent = "";
         if (match(TokenType::KEYWORD, "Bloodline")) {
             Token parentName = consume(TokenType::IDENTIFIER, "Expected parent class name after 'Bloodline'.");
-            parent = parentName.value;
+            parent = textOf(parentName);
         }
         consume(TokenType::OPERATOR, "{", "Expected '{' before class body.");
         std::vector<ASTNodePtr> body;
@@ -678,7 +1533,7 @@ private:
             body.push_back(statement());
         }
         consume(TokenType::OPERATOR, "}", "Expected '}' after class body.");
-        return std::make_shared<ClassDeclaration>(className.value, params, body, parent, className.line, className.column);
+        return make<ClassDeclaration>(textOf(className), params, body, parent, className.offset);
     }
 
     ASTNodePtr expression() {
@@ -690,7 +1545,7 @@ private:
         while (match(TokenType::OPERATOR, "||")) {
             Token op = previous();
             ASTNodePtr right = logicalAnd();
-            expr = std::make_shared<BinaryOp>(op.value, expr, right, op.line, op.column);
+            expr = make<BinaryOp>(textOf(op), expr, right, op.offset);
         }
         return expr;
     }
@@ -700,7 +1555,7 @@ private:
         while (match(TokenType::OPERATOR, "&&")) {
             Token op = previous();
             ASTNodePtr right = equality();
-            expr = std::make_shared<BinaryOp>(op.value, expr, right, op.line, op.column);
+            expr = make<BinaryOp>(textOf(op), expr, right, op.offset);
         }
         return expr;
     }
@@ -710,7 +1565,7 @@ private:
         while (match(TokenType::OPERATOR, "==") || match(TokenType::OPERATOR, "!=")) {
             Token op = previous();
             ASTNodePtr right = comparison();
-            expr = std::make_shared<BinaryOp>(op.value, expr, right, op.line, op.column);
+            expr = make<BinaryOp>(textOf(op), expr, right, op.offset);
         }
         return expr;
     }
@@ -721,7 +1576,7 @@ private:
                match(TokenType::OPERATOR, "<=") || match(TokenType::OPERATOR, ">=")) {
             Token op = previous();
             ASTNodePtr right = term();
-            expr = std::make_shared<BinaryOp>(op.value, expr, right, op.line, op.column);
+            expr = make<BinaryOp>(textOf(op), expr, right, op.offset);
         }
         return expr;
     }
@@ -731,7 +1586,7 @@ private:
         while (match(TokenType::OPERATOR, "+") || match(TokenType::OPERATOR, "-")) {
             Token op = previous();
             ASTNodePtr right = factor();
-            expr = std::make_shared<BinaryOp>(op.value, expr, right, op.line, op.column);
+            expr = make<BinaryOp>(textOf(op), expr, right, op.offset);
         }
         return expr;
     }
@@ -741,7 +1596,7 @@ private:
         while (match(TokenType::OPERATOR, "*") || match(TokenType::OPERATOR, "/") || match(TokenType::OPERATOR, "%")) {
             Token op = previous();
             ASTNodePtr right = unary();
-            expr = std::make_shared<BinaryOp>(op.value, expr, right, op.line, op.column);
+            expr = make<BinaryOp>(textOf(op), expr, right, op.offset);
         }
         return expr;
     }
@@ -750,21 +1605,36 @@ private:
         if (match(TokenType::OPERATOR, "!") || match(TokenType::OPERATOR, "-")) {
             Token op = previous();
             ASTNodePtr operand = unary();
-            return std::make_shared<UnaryOp>(op.value, operand, op.line, op.column);
+            return make<UnaryOp>(textOf(op), operand, op.offset);
+        }
+        return postfix();
+    }
+
+    ASTNodePtr postfix() {
+        ASTNodePtr expr = primary();
+        while (match(TokenType::OPERATOR, "[")) {
+            Token bracket = previous();
+            ASTNodePtr index = expression();
+            consume(TokenType::OPERATOR, "]", "Expected ']' after index.");
+            expr = make<IndexExpression>(expr, index, bracket.offset);
         }
-        return primary();
+        return expr;
     }
 
     ASTNodePtr primary() {
         if (match(TokenType::NUMBER)) {
             Token number = previous();
-            return std::make_shared<NumberLiteral>(std::stoi(number.value), number.line, number.column);
+            long long value = 0;
+            std::string_view digits = tokens.text(number);
+            std::from_chars(digits.data(), digits.data() + digits.size(), value);
+            return make<NumberLiteral>(value, number.offset);
         }
         if (match(TokenType::STRING)) {
             Token str = previous();
-            return std::make_shared<StringLiteral>(str.value, str.line, str.column);
+            return make<StringLiteral>(textOf(str), str.offset);
         }
-        if (match(TokenType::IDENTIFIER)) {
+        if (match(TokenType::IDENTIFIER) || match(TokenType::KEYWORD, "len") ||
+            match(TokenType::KEYWORD, "str") || match(TokenType::KEYWORD, "int")) {
             Token ident = previous();
             if (match(TokenType::OPERATOR, "(")) {
                 std::vector<ASTNodePtr> args;
@@ -774,9 +1644,9 @@ private:
                     } while (match(TokenType::OPERATOR, ","));
                 }
                 consume(TokenType::OPERATOR, ")", "Expected ')' after arguments.");
-                return std::make_shared<FunctionCall>(ident.value, args, ident.line, ident.column);
+                return make<FunctionCall>(textOf(ident), args, ident.offset);
             }
-            return std::make_shared<Identifier>(ident.value, ident.line, ident.column);
+            return make<Identifier>(textOf(ident), ident.offset);
         }
         if (match(TokenType::OPERATOR, "(")) {
             ASTNodePtr expr = expression();
@@ -792,23 +1662,7 @@ private:
                 } while (match(TokenType::OPERATOR, ","));
             }
             consume(TokenType::OPERATOR, "]", "Expected ']' after list elements.");
-            // Convert to a single string with comma separation for simplicity
-            std::string listValue = "[";
-            for (size_t i = 0; i < elements.size(); ++i) {
-                if (auto num = std::dynamic_pointer_cast<NumberLiteral>(elements[i])) {
-                    listValue += std::to_string(num->value);
-                }
-                else if (auto str = std::dynamic_pointer_cast<StringLiteral>(elements[i])) {
-                    listValue += "\"" + str->value + "\"";
-                }
-                else {
-                    listValue += "UNKNOWN";
-                }
-                if (i != elements.size() - 1)
-                    listValue += ", ";
-            }
-            listValue += "]";
-            return std::make_shared<StringLiteral>(listValue, previous().line, previous().column);
+            return make<ListLiteral>(elements, previous().offset);
         }
         if (match(TokenType::OPERATOR, "{")) {
             // Dictionary literal
@@ -820,7 +1674,7 @@ private:
                     key = str->value;
                 }
                 else {
-                    throw std::runtime_error("Dictionary keys must be strings.");
+                    throw SyntaxError("Dictionary keys must be strings.", keyNode->offset);
                 }
                 consume(TokenType::OPERATOR, ":", "Expected ':' after key in dictionary.");
                 ASTNodePtr valueNode = expression();
@@ -847,23 +1701,23 @@ private:
                 count++;
             }
             dictValue += "}";
-            return std::make_shared<StringLiteral>(dictValue, previous().line, previous().column);
+            return make<StringLiteral>(dictValue, previous().offset);
         }
-        throw std::runtime_error("Unexpected token '" + peek().value + "' at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column));
+        throw SyntaxError("Unexpected token '" + textOf(peek()) + "' at " + lines().describe(peek().offset), peek().offset);
     }
 
     Token consume(TokenType type, const std::string& errorMessage) {
         if (check(type)) {
             return advance();
         }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
+        throw SyntaxError("Parser Error at " + lines().describe(peek().offset) + ": " + errorMessage, peek().offset);
     }
 
     Token consume(TokenType type, const std::string& value, const std::string& errorMessage) {
         if (check(type, value)) {
             return advance();
         }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
+        throw SyntaxError("Parser Error at " + lines().describe(peek().offset) + ": " + errorMessage, peek().offset);
     }
 
     Token consume(const std::string& typeStr, const std::string& errorMessage) {
@@ -881,373 +1735,5039 @@ private:
         if (check(TokenType::IDENTIFIER)) {
             return advance();
         }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
+        throw SyntaxError("Parser Error at " + lines().describe(peek().offset) + ": " + errorMessage, peek().offset);
     }
 };
 
-// ======================== Interpreter Definitions ========================
+// ======================== Incremental Parsing ========================
 
-class Environment;
-using EnvPtr = std::shared_ptr<Environment>;
+// Replaces 'removed' bytes at 'offset' with 'inserted'.
+struct TextEdit {
+    uint32_t offset;
+    uint32_t removed;
+    std::string inserted;
+};
 
-class Environment {
+// A parsed source kept up to date under edits, for editor tooling. The tree
+// is held as one segment per top-level statement with its byte span. An edit
+// relexes and reparses from the last statement before it, one statement at a
+// time, until a new statement ends where an old one did once shifted by the
+// edit. The text after that point is unchanged, so parsing it again would
+// rebuild the old statements; they are reused as they are. The work is
+// proportional to the statements the edit touches, plus shifting the spans of
+// the statements after it.
+class Document {
 public:
-    EnvPtr enclosing;
-    std::unordered_map<std::string, std::string> variables;
+    struct Segment {
+        uint32_t begin;
+        uint32_t end;
+        // 'begin' when the statement was parsed.
+        uint32_t parsedAt;
+        ASTNodePtr statement;
+    };
 
-    Environment() : enclosing(nullptr) {}
-    Environment(EnvPtr enclosing) : enclosing(enclosing) {}
+    explicit Document(std::string text = "") : source(std::move(text)) {
+        reparse(0, static_cast<uint32_t>(source.size()), 0);
+    }
 
-    void define(const std::string& name, const std::string& value) {
-        variables[name] = value;
+    const std::string& text() const {
+        return source;
     }
 
-    void assign(const std::string& name, const std::string& value) {
-        if (variables.find(name) != variables.end()) {
-            variables[name] = value;
-            return;
+    // The top-level statements, in order.
+    const std::vector<Segment>& statements() const {
+        return segments;
+    }
+
+    // The table the statements' names are interned into. It lives as long
+    // as the document, or an index or Program still holding it.
+    const std::shared_ptr<SymbolTable>& symbols() const {
+        return names;
+    }
+
+    // Applies the edit and reparses the damaged statements. On a syntax error
+    // the text is still updated and the error rethrown. The statements before
+    // the failing one and those after the damage are kept, and the damaged
+    // span is reparsed along with the next edit.
+    void apply(const TextEdit& edit) {
+        if (edit.offset > source.size() || edit.removed > source.size() - edit.offset) {
+            throw std::runtime_error("Edit is outside the document.");
         }
-        if (enclosing != nullptr) {
-            enclosing->assign(name, value);
-            return;
+        if (source.size() - edit.removed + edit.inserted.size() > UINT32_MAX) {
+            throw std::runtime_error("Source exceeds the 4 GB limit.");
         }
-        throw std::runtime_error("Undefined variable '" + name + "'.");
+        source.replace(edit.offset, edit.removed, edit.inserted);
+        int64_t delta = static_cast<int64_t>(edit.inserted.size()) - edit.removed;
+        uint32_t begin = edit.offset;
+        uint32_t end = edit.offset + static_cast<uint32_t>(edit.inserted.size());
+        if (damaged) {
+            // Carry the damage through the edit; a bound inside the replaced
+            // text collapses onto it.
+            uint32_t oldEnd = edit.offset + edit.removed;
+            auto carry = [&](uint32_t offset) {
+                return offset < oldEnd ? std::min(offset, edit.offset) : static_cast<uint32_t>(offset + delta);
+            };
+            begin = std::min(begin, carry(damage.first));
+            end = std::max(end, carry(damage.second));
+        }
+        reparse(begin, end, delta);
+    }
+
+    // A Program over the current statements.
+    std::shared_ptr<Program> program() const {
+        std::vector<ASTNodePtr> statements;
+        statements.reserve(segments.size());
+        for (auto& segment : segments) statements.push_back(segment.statement);
+        auto program = std::make_shared<Program>(statements);
+        program->symbols = names;
+        return program;
+    }
+
+    // Node offsets of a reused statement date from when it was parsed; this
+    // maps one from top-level statement 'index' to the current text.
+    uint32_t currentOffset(size_t index, uint32_t nodeOffset) const {
+        return nodeOffset + segments[index].begin - segments[index].parsedAt;
     }
 
-    std::string get(const std::string& name) {
-        if (variables.find(name) != variables.end()) {
-            return variables[name];
+private:
+    static constexpr size_t kWindow = 4096;
+
+    std::string source;
+    std::vector<Segment> segments;
+    std::shared_ptr<SymbolTable> names = std::make_shared<SymbolTable>();
+    // The span left unparsed by a syntax error, if any.
+    bool damaged = false;
+    std::pair<uint32_t, uint32_t> damage;
+
+    // Reparses the changed span [begin, end) of the new text. Segments still
+    // hold offsets from before the edit, which changed the length by 'delta'.
+    void reparse(uint32_t begin, uint32_t end, int64_t delta) {
+        SymbolTable::Scope scope(*names);
+        size_t first = std::lower_bound(segments.begin(), segments.end(), begin,
+                                        [](const Segment& segment, uint32_t offset) { return segment.end < offset; }) -
+                       segments.begin();
+        // The last statement before the edit is reparsed too: where it ends
+        // depends on the token after it, which the edit may have changed.
+        if (first > 0) --first;
+        uint32_t from = first == 0 ? 0 : segments[first - 1].end;
+        for (size_t window = kWindow;; window *= 2) {
+            size_t limit = std::min(source.size(), static_cast<size_t>(end) + window);
+            size_t newline = source.find('\n', limit);
+            limit = newline == std::string::npos ? source.size() : newline + 1;
+            bool whole = limit == source.size();
+            std::vector<Segment> fresh;
+            size_t resync = segments.size();
+            bool finished = false;
+            uint32_t lexedTo = UINT32_MAX;
+            try {
+                TokenList tokens = Lexer::tokenizeRange(source, from, limit);
+                lexedTo = tokens.back().offset;
+                Parser parser(tokens, nullptr);
+                while (!parser.done()) {
+                    size_t start = parser.position();
+                    ASTNodePtr statement = parser.parseStatement();
+                    size_t next = parser.position();
+                    // A statement that ran into the window's end may continue past it.
+                    if (next == tokens.size() - 1 && !whole) break;
+                    if (!statement) continue;
+                    const Token& last = tokens[next - 1];
+                    Segment segment{tokens[start].offset, last.offset + last.length, tokens[start].offset, statement};
+                    fresh.push_back(segment);
+                    if (segment.end < end) continue;
+                    int64_t oldEnd = segment.end - delta;
+                    auto old = std::lower_bound(segments.begin() + first, segments.end(), oldEnd,
+                                                [](const Segment& s, int64_t offset) { return s.end < offset; });
+                    if (old != segments.end() && old->end == oldEnd) {
+                        resync = old - segments.begin();
+                        break;
+                    }
+                }
+                finished = resync != segments.size() || (parser.done() && whole);
+            }
+            catch (const std::runtime_error& e) {
+                // Only an error at the window's end may be one of its making.
+                auto syntaxError = dynamic_cast<const SyntaxError*>(&e);
+                if (whole || (syntaxError && syntaxError->offset < lexedTo)) {
+                    // The statements parsed before the error are kept, and the
+                    // damage starts with the one that failed. Old statements
+                    // wholly after the damage are kept too.
+                    uint32_t damageBegin = fresh.empty() ? from : fresh.back().end;
+                    uint32_t damageEnd = std::max(end, damageBegin);
+                    int64_t oldEnd = damageEnd - delta;
+                    auto after = std::lower_bound(segments.begin() + first, segments.end(), oldEnd,
+                                                  [](const Segment& s, int64_t offset) { return s.begin < offset; });
+                    splice(first, after - segments.begin(), fresh, delta);
+                    damaged = true;
+                    damage = {damageBegin, damageEnd};
+                    throw;
+                }
+            }
+            if (!finished) continue;
+            splice(first, resync == segments.size() ? segments.size() : resync + 1, fresh, delta);
+            damaged = false;
+            return;
         }
-        if (enclosing != nullptr) {
-            return enclosing->get(name);
+    }
+
+    // Replaces segments [first, keep) with 'fresh' and shifts the rest.
+    void splice(size_t first, size_t keep, const std::vector<Segment>& fresh, int64_t delta) {
+        for (size_t i = keep; i < segments.size(); ++i) {
+            segments[i].begin = static_cast<uint32_t>(segments[i].begin + delta);
+            segments[i].end = static_cast<uint32_t>(segments[i].end + delta);
         }
-        throw std::runtime_error("Undefined variable '" + name + "'.");
+        segments.erase(segments.begin() + first, segments.begin() + keep);
+        segments.insert(segments.begin() + first, fresh.begin(), fresh.end());
     }
 };
 
-class Interpreter {
+// ======================== Escape Analysis ========================
+
+// Decides for every block whether it needs a scope at all and whether that
+// scope can outlive the statement that created it. Incantations capture only
+// boxed upvalues and Creatures capture nothing, so no scope escapes: a block
+// that declares something gets a frame scope.
+//
+// Also finds the Cauldron literals whose value cannot outlive its use: one
+// that is only indexed, iterated, measured, printed or used as an operand, or
+// that initializes a block-local variable used only in those ways. Any other
+// use (an argument, an element, a value stored elsewhere, an upvalue) lets it
+// escape. Runs after the UpvalueResolver.
+class EscapeAnalyzer {
 public:
-    EnvPtr globals;
-    EnvPtr environment;
+    void analyze(std::shared_ptr<Program> program) {
+        for (auto& stmt : program->statements) {
+            // Top-level variables are globals, which Incantations reach by name.
+            if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(stmt)) {
+                analyzeExpression(varDecl->value, true);
+                continue;
+            }
+            analyzeStatement(stmt);
+        }
+        for (auto& candidate : locals) {
+            if (!escaping.count(candidate.first)) candidate.second->reusable = true;
+        }
+    }
 
-    Interpreter() {
-        globals = std::make_shared<Environment>();
-        environment = globals;
-        defineBuiltIns();
+private:
+    // Variables whose value may escape, and block-local variables
+    // initialized with a Cauldron literal.
+    std::unordered_set<Symbol> escaping;
+    std::vector<std::pair<Symbol, std::shared_ptr<ListLiteral>>> locals;
+
+    ScopeKind analyzeBlock(const std::vector<ASTNodePtr>& statements) {
+        ScopeKind kind = ScopeKind::None;
+        for (auto& stmt : statements) {
+            kind = std::max(kind, analyzeStatement(stmt));
+        }
+        return kind;
     }
 
-    void interpret(std::shared_ptr<Program> program) {
-        try {
-            for (auto& stmt : program->statements) {
-                execute(stmt);
+    // Returns what the statement requires of the scope it runs in.
+    ScopeKind analyzeStatement(ASTNodePtr node) {
+        if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(node)) {
+            if (auto list = std::dynamic_pointer_cast<ListLiteral>(varDecl->value)) {
+                for (auto& element : list->elements) {
+                    analyzeExpression(element, true);
+                }
+                locals.emplace_back(varDecl->symbol, list);
+            }
+            else {
+                analyzeExpression(varDecl->value, true);
             }
+            return ScopeKind::Frame;
         }
-        catch (const std::runtime_error& e) {
-            std::cerr << "Runtime Error: " << e.what() << std::endl;
+        if (auto assign = std::dynamic_pointer_cast<Assignment>(node)) {
+            analyzeExpression(assign->value, true);
+            return ScopeKind::None;
+        }
+        if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) {
+            escaping.insert(funcDecl->upvalueSymbols.begin(), funcDecl->upvalueSymbols.end());
+            analyzeBlock(funcDecl->body);
+            return ScopeKind::Frame;
+        }
+        if (auto classDecl = std::dynamic_pointer_cast<ClassDeclaration>(node)) {
+            analyzeBlock(classDecl->body);
+            return ScopeKind::Frame;
+        }
+        if (auto printStmt = std::dynamic_pointer_cast<PrintStatement>(node)) {
+            analyzeExpression(printStmt->expression, false);
+            return ScopeKind::None;
+        }
+        if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
+            analyzeExpression(ifStmt->condition, false);
+            ifStmt->if_scope = analyzeBlock(ifStmt->if_body);
+            ifStmt->else_scope = analyzeBlock(ifStmt->else_body);
+            return nested(std::max(ifStmt->if_scope, ifStmt->else_scope));
+        }
+        if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
+            analyzeExpression(whileLoop->condition, false);
+            whileLoop->body_scope = analyzeBlock(whileLoop->body);
+            return nested(whileLoop->body_scope);
+        }
+        if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
+            ScopeKind init = analyzeStatement(forLoop->initialization);
+            analyzeExpression(forLoop->condition, false);
+            analyzeStatement(forLoop->increment);
+            forLoop->body_scope = analyzeBlock(forLoop->body);
+            return std::max(init, nested(forLoop->body_scope));
+        }
+        if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            // A parallel loop copies its Cauldron to the workers.
+            analyzeExpression(forEach->items, false);
+            forEach->body_scope = analyzeBlock(forEach->body);
+            return nested(forEach->body_scope);
+        }
+        if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
+            tryCatch->try_scope = analyzeBlock(tryCatch->try_block);
+            // The catch scope always holds 'error'.
+            tryCatch->catch_scope = std::max(ScopeKind::Frame, analyzeBlock(tryCatch->catch_block));
+            return nested(std::max(tryCatch->try_scope, tryCatch->catch_scope));
         }
+        analyzeExpression(node, true);
+        return ScopeKind::None;
+    }
+
+    // 'escapes' tells whether the expression's value may be kept beyond its
+    // use by the enclosing expression.
+    void analyzeExpression(ASTNodePtr node, bool escapes) {
+        if (auto list = std::dynamic_pointer_cast<ListLiteral>(node)) {
+            list->reusable = !escapes;
+            for (auto& element : list->elements) {
+                analyzeExpression(element, true);
+            }
+        }
+        else if (auto ident = std::dynamic_pointer_cast<Identifier>(node)) {
+            if (escapes) escaping.insert(ident->symbol);
+        }
+        else if (auto index = std::dynamic_pointer_cast<IndexExpression>(node)) {
+            analyzeExpression(index->object, false);
+            analyzeExpression(index->index, false);
+        }
+        else if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(node)) {
+            analyzeExpression(binOp->left, false);
+            analyzeExpression(binOp->right, false);
+        }
+        else if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(node)) {
+            analyzeExpression(unaryOp->operand, false);
+        }
+        else if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(node)) {
+            // len, str and int are keywords, so these are always the builtins.
+            bool measures = funcCall->name == "len" || funcCall->name == "str" || funcCall->name == "int";
+            for (auto& arg : funcCall->args) {
+                analyzeExpression(arg, !measures);
+            }
+        }
+    }
+
+    // A nested scope only constrains its parent when it escapes.
+    static ScopeKind nested(ScopeKind kind) {
+        return kind == ScopeKind::Heap ? ScopeKind::Heap : ScopeKind::None;
+    }
+};
+
+// ======================== Upvalue Resolution ========================
+
+// Records, for every Incantation, which variables of enclosing non-global
+// scopes its body refers to. Only those are boxed and carried by the closure;
+// globals are still looked up by name and everything else stays unboxed in
+// its scope.
+class UpvalueResolver {
+public:
+    // 'source' is the program's text, for the position in an error.
+    explicit UpvalueResolver(std::string_view source) : source(source) {}
+
+    void resolve(std::shared_ptr<Program> program) {
+        beginScope();
+        resolveBlock(program->statements);
+        endScope();
     }
 
 private:
-    void execute(ASTNodePtr node) {
+    struct FunctionContext {
+        std::shared_ptr<FunctionDeclaration> decl;
+        size_t baseScope;
+    };
+
+    // A parallel Forar, whose body sees outside variables through copies.
+    struct SwarmContext {
+        std::shared_ptr<ForEachLoop> loop;
+        size_t baseScope;
+    };
+
+    std::string_view source;
+    std::vector<std::unordered_set<std::string>> scopes;
+    std::vector<FunctionContext> functions;
+    std::vector<SwarmContext> swarms;
+
+    void beginScope() { scopes.emplace_back(); }
+    void endScope() { scopes.pop_back(); }
+    void declare(const std::string& name) { scopes.back().insert(name); }
+
+    void resolveBlock(const std::vector<ASTNodePtr>& statements) {
+        for (auto& stmt : statements) {
+            resolveNode(stmt);
+        }
+    }
+
+    void resolveScopedBlock(const std::vector<ASTNodePtr>& statements) {
+        beginScope();
+        resolveBlock(statements);
+        endScope();
+    }
+
+    void resolveNode(ASTNodePtr node) {
+        if (!node) return;
         if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(node)) {
-            executeVarDeclaration(varDecl);
+            resolveNode(varDecl->value);
+            declare(varDecl->name);
         }
         else if (auto assign = std::dynamic_pointer_cast<Assignment>(node)) {
-            executeAssignment(assign);
+            checkSwarmWrite(*assign);
+            reference(assign->name);
+            resolveNode(assign->value);
         }
         else if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) {
-            executeFunctionDeclaration(funcDecl);
+            declare(funcDecl->name);
+            resolveFunction(funcDecl);
         }
         else if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(node)) {
-            executeFunctionCall(funcCall);
+            reference(funcCall->name);
+            for (auto& arg : funcCall->args) {
+                resolveNode(arg);
+            }
         }
         else if (auto printStmt = std::dynamic_pointer_cast<PrintStatement>(node)) {
-            executePrintStatement(printStmt);
+            resolveNode(printStmt->expression);
         }
         else if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
-            executeIfStatement(ifStmt);
+            resolveNode(ifStmt->condition);
+            resolveScopedBlock(ifStmt->if_body);
+            resolveScopedBlock(ifStmt->else_body);
         }
         else if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
-            executeWhileLoop(whileLoop);
+            resolveNode(whileLoop->condition);
+            resolveScopedBlock(whileLoop->body);
         }
         else if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
-            executeForLoop(forLoop);
+            // Mirrors the interpreter: an undeclared loop variable lives in the loop's own scope.
+            beginScope();
+            auto init = std::dynamic_pointer_cast<Assignment>(forLoop->initialization);
+            if (init && !isDeclared(init->name)) {
+                resolveNode(init->value);
+                declare(init->name);
+            }
+            else {
+                resolveNode(forLoop->initialization);
+            }
+            resolveNode(forLoop->condition);
+            resolveScopedBlock(forLoop->body);
+            resolveNode(forLoop->increment);
+            endScope();
+        }
+        else if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            resolveNode(forEach->items);
+            for (auto& reduction : forEach->reductions) {
+                reference(reduction.name);
+            }
+            beginScope();
+            declare(forEach->name);
+            if (forEach->parallel) swarms.push_back({forEach, scopes.size() - 1});
+            resolveScopedBlock(forEach->body);
+            if (forEach->parallel) swarms.pop_back();
+            endScope();
         }
         else if (auto classDecl = std::dynamic_pointer_cast<ClassDeclaration>(node)) {
-            executeClassDeclaration(classDecl);
+            declare(classDecl->name);
+            beginScope();
+            for (auto& param : classDecl->params) {
+                declare(param);
+            }
+            resolveBlock(classDecl->body);
+            endScope();
         }
         else if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
-            executeTryCatch(tryCatch);
+            resolveScopedBlock(tryCatch->try_block);
+            beginScope();
+            declare("error");
+            resolveBlock(tryCatch->catch_block);
+            endScope();
         }
-        else {
-            throw std::runtime_error("Unknown AST node type.");
+        else if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(node)) {
+            resolveNode(binOp->left);
+            resolveNode(binOp->right);
+        }
+        else if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(node)) {
+            resolveNode(unaryOp->operand);
+        }
+        else if (auto ident = std::dynamic_pointer_cast<Identifier>(node)) {
+            reference(ident->name);
+        }
+        else if (auto list = std::dynamic_pointer_cast<ListLiteral>(node)) {
+            for (auto& element : list->elements) {
+                resolveNode(element);
+            }
+        }
+        else if (auto index = std::dynamic_pointer_cast<IndexExpression>(node)) {
+            resolveNode(index->object);
+            resolveNode(index->index);
         }
     }
 
-    void executeVarDeclaration(std::shared_ptr<VarDeclaration> varDecl) {
-        std::string value = evaluate(varDecl->value);
-        environment->define(varDecl->name, value);
+    bool isDeclared(const std::string& name) const {
+        for (auto& scope : scopes) {
+            if (scope.count(name)) return true;
+        }
+        return false;
     }
 
-    void executeAssignment(std::shared_ptr<Assignment> assign) {
-        std::string value = evaluate(assign->value);
-        environment->assign(assign->name, value);
+    // Whether 'name', in the body of a parallel Forar, is a variable from
+    // outside the loop that the loop does not gather.
+    bool isShared(const SwarmContext& swarm, const std::string& name) const {
+        for (size_t i = swarm.baseScope; i < scopes.size(); ++i) {
+            if (scopes[i].count(name)) return false;
+        }
+        for (auto& reduction : swarm.loop->reductions) {
+            if (reduction.name == name) return false;
+        }
+        return true;
     }
 
-    void executeFunctionDeclaration(std::shared_ptr<FunctionDeclaration> funcDecl) {
-        // For simplicity, store function as a string representing its name
-        // In a full implementation, you'd store parameters and body
-        environment->define(funcDecl->name, "Function");
+    // Workers assign to their own copies of the variables they share, so
+    // the assignment would be lost when the loop ends.
+    void checkSwarmWrite(const Assignment& assign) const {
+        for (auto& swarm : swarms) {
+            if (!isShared(swarm, assign.name)) continue;
+            throw SyntaxError("Error at " + LineIndex(source).describe(assign.offset) +
+                                  ": Forar Geminio cannot assign to '" + assign.name +
+                                  "', which is declared outside the loop; gather it to keep what the workers make of it.",
+                              assign.offset);
+        }
     }
 
-    void executeFunctionCall(std::shared_ptr<FunctionCall> funcCall) {
-        // For simplicity, handle built-in functions and user-defined functions
-        if (environment->variables.find(funcCall->name) != environment->variables.end()) {
-            std::string func = environment->get(funcCall->name);
-            if (func == "Function") {
-                // Execute function body
-                // Skipping implementation for brevity
-            }
-            else if (func == "Print") {
-                std::string arg = evaluate(funcCall->args[0]);
-                std::cout << arg << std::endl;
-            }
-            else {
-                // Handle other built-in functions
-                std::cout << "Function call: " << funcCall->name << std::endl;
-            }
-        }
-        else {
-            std::cout << "Function '" << funcCall->name << "' is not defined." << std::endl;
+    // Records a name the body of a parallel Forar takes from outside the
+    // loop; reductions are handed to the workers separately.
+    void shareWithSwarm(SwarmContext& swarm, const std::string& name) {
+        if (!isShared(swarm, name)) return;
+        ForEachLoop& loop = *swarm.loop;
+        if (std::find(loop.shared.begin(), loop.shared.end(), name) == loop.shared.end()) {
+            loop.shared.push_back(name);
+            loop.sharedSymbols.push_back(intern(name));
         }
     }
 
-    void executePrintStatement(std::shared_ptr<PrintStatement> printStmt) {
-        std::string value = evaluate(printStmt->expression);
-        std::cout << value << std::endl;
+    // Parameters and body-level declarations share the call's scope.
+    void resolveFunction(std::shared_ptr<FunctionDeclaration> funcDecl) {
+        functions.push_back({funcDecl, scopes.size()});
+        beginScope();
+        for (auto& param : funcDecl->params) {
+            declare(param);
+        }
+        resolveBlock(funcDecl->body);
+        endScope();
+        functions.pop_back();
     }
 
-    void executeIfStatement(std::shared_ptr<IfStatement> ifStmt) {
-        std::string condition = evaluate(ifStmt->condition);
-        if (condition == "true" || condition == "1") {
-            EnvPtr newEnv = std::make_shared<Environment>(environment);
-            executeBlock(ifStmt->if_body, newEnv);
+    void reference(const std::string& name) {
+        for (auto& swarm : swarms) {
+            shareWithSwarm(swarm, name);
         }
-        else {
-            EnvPtr newEnv = std::make_shared<Environment>(environment);
-            executeBlock(ifStmt->else_body, newEnv);
+        if (functions.empty()) return;
+        // Scope 0 is the global scope; globals are never captured.
+        size_t declaringScope = 0;
+        for (size_t i = scopes.size(); i-- > 1;) {
+            if (scopes[i].count(name)) {
+                declaringScope = i;
+                break;
+            }
         }
-    }
-
-    void executeWhileLoop(std::shared_ptr<WhileLoop> whileLoop) {
-        while (true) {
-            std::string condition = evaluate(whileLoop->condition);
-            if (condition != "true" && condition != "1") break;
-            EnvPtr newEnv = std::make_shared<Environment>(environment);
-            executeBlock(whileLoop->body, newEnv);
+        if (declaringScope == 0) return;
+        // Every Incantation between the declaration and the reference carries
+        // the upvalue, so inner closures can capture it from their parent's call.
+        for (auto& context : functions) {
+            if (context.baseScope <= declaringScope) continue;
+            auto& upvalues = context.decl->upvalues;
+            if (std::find(upvalues.begin(), upvalues.end(), name) == upvalues.end()) {
+                upvalues.push_back(name);
+                context.decl->upvalueSymbols.push_back(intern(name));
+            }
         }
     }
+};
 
-    void executeForLoop(std::shared_ptr<ForLoop> forLoop) {
-        // Execute initialization
-        execute(forLoop->initialization);
-        while (true) {
-            std::string condition = evaluate(forLoop->condition);
-            if (condition != "true" && condition != "1") break;
-            EnvPtr newEnv = std::make_shared<Environment>(environment);
-            executeBlock(forLoop->body, newEnv);
-            // Execute increment
-            execute(forLoop->increment);
-        }
+// ======================== Bounds-Check Elimination ========================
+
+// Recognizes the counted Loopus over a Cauldron,
+//
+//     Loopus i = <k >= 0>; i < len(xs); i = i + <step > 0> { ... xs[i] ... }
+//
+// When the body never writes 'i' or 'xs' and calls no Incantation that
+// could, 'i' stays within [0, len(xs)) inside the body. Every 'xs[i]' in the
+// body then loads without a bounds check, and len(xs) is evaluated once.
+class BoundsCheckEliminator {
+public:
+    void analyze(std::shared_ptr<Program> program) {
+        analyzeBlock(program->statements);
     }
 
-    void executeClassDeclaration(std::shared_ptr<ClassDeclaration> classDecl) {
-        // For simplicity, store class as a string
-        environment->define(classDecl->name, "Class");
+private:
+    void analyzeBlock(const std::vector<ASTNodePtr>& statements) {
+        for (auto& stmt : statements) {
+            analyzeNode(stmt);
+        }
     }
 
-    void executeTryCatch(std::shared_ptr<TryCatch> tryCatch) {
-        try {
-            EnvPtr tryEnv = std::make_shared<Environment>(environment);
-            executeBlock(tryCatch->try_block, tryEnv);
+    void analyzeNode(ASTNodePtr node) {
+        if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
+            analyzeForLoop(forLoop);
+            analyzeBlock(forLoop->body);
         }
-        catch (const std::runtime_error& e) {
-            EnvPtr catchEnv = std::make_shared<Environment>(environment);
-            // Define 'error' variable
-            catchEnv->define("error", e.what());
-            executeBlock(tryCatch->catch_block, catchEnv);
+        else if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
+            analyzeBlock(ifStmt->if_body);
+            analyzeBlock(ifStmt->else_body);
+        }
+        else if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
+            analyzeBlock(whileLoop->body);
+        }
+        else if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            analyzeBlock(forEach->body);
+        }
+        else if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) {
+            analyzeBlock(funcDecl->body);
+        }
+        else if (auto classDecl = std::dynamic_pointer_cast<ClassDeclaration>(node)) {
+            analyzeBlock(classDecl->body);
+        }
+        else if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
+            analyzeBlock(tryCatch->try_block);
+            analyzeBlock(tryCatch->catch_block);
         }
     }
 
-    void executeBlock(const std::vector<ASTNodePtr>& statements, EnvPtr env) {
-        EnvPtr previous = environment;
-        environment = env;
-        try {
-            for (auto& stmt : statements) {
-                execute(stmt);
-            }
+    void analyzeForLoop(std::shared_ptr<ForLoop> forLoop) {
+        auto init = std::dynamic_pointer_cast<Assignment>(forLoop->initialization);
+        auto start = init ? std::dynamic_pointer_cast<NumberLiteral>(init->value) : nullptr;
+        if (!start || start->value < 0) return;
+        const std::string& var = init->name;
+
+        auto cond = std::dynamic_pointer_cast<BinaryOp>(forLoop->condition);
+        if (!cond || cond->op != "<" || !isIdentifier(cond->left, var)) return;
+        auto lenCall = std::dynamic_pointer_cast<FunctionCall>(cond->right);
+        if (!lenCall || lenCall->name != "len" || lenCall->args.size() != 1) return;
+        auto list = std::dynamic_pointer_cast<Identifier>(lenCall->args[0]);
+        if (!list || list->name == var) return;
+
+        auto inc = std::dynamic_pointer_cast<Assignment>(forLoop->increment);
+        auto step = inc ? std::dynamic_pointer_cast<BinaryOp>(inc->value) : nullptr;
+        if (!step || inc->name != var || step->op != "+" || !isIdentifier(step->left, var)) return;
+        auto amount = std::dynamic_pointer_cast<NumberLiteral>(step->right);
+        if (!amount || amount->value <= 0) return;
+
+        for (auto& stmt : forLoop->body) {
+            if (mayWrite(stmt, var) || mayWrite(stmt, list->name)) return;
         }
-        catch (...) {
-            environment = previous;
-            throw;
+        forLoop->invariant_bound = true;
+        for (auto& stmt : forLoop->body) {
+            eliminateChecks(stmt, list->name, var);
         }
-        environment = previous;
     }
 
-    std::string evaluate(ASTNodePtr expr) {
-        if (auto numLit = std::dynamic_pointer_cast<NumberLiteral>(expr)) {
-            return std::to_string(numLit->value);
+    static bool isIdentifier(ASTNodePtr node, const std::string& name) {
+        auto ident = std::dynamic_pointer_cast<Identifier>(node);
+        return ident && ident->name == name;
+    }
+
+    // Conservative: any assignment or redeclaration of 'name', or any call
+    // that is not a builtin, may change it.
+    static bool mayWrite(ASTNodePtr node, const std::string& name) {
+        if (!node) return false;
+        if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(node)) {
+            return varDecl->name == name || mayWrite(varDecl->value, name);
         }
-        if (auto strLit = std::dynamic_pointer_cast<StringLiteral>(expr)) {
-            return strLit->value;
+        if (auto assign = std::dynamic_pointer_cast<Assignment>(node)) {
+            return assign->name == name || mayWrite(assign->value, name);
         }
-        if (auto ident = std::dynamic_pointer_cast<Identifier>(expr)) {
-            return environment->get(ident->name);
+        if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) {
+            return funcDecl->name == name;
         }
-        if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(expr)) {
-            std::string left = evaluate(binOp->left);
-            std::string right = evaluate(binOp->right);
-            if (binOp->op == "+") {
-                return left + right;
-            }
-            if (binOp->op == "-") {
-                // Convert to integers for subtraction
-                int l = std::stoi(left);
-                int r = std::stoi(right);
-                return std::to_string(l - r);
-            }
-            if (binOp->op == "*") {
-                int l = std::stoi(left);
-                int r = std::stoi(right);
-                return std::to_string(l * r);
-            }
-            if (binOp->op == "/") {
-                int l = std::stoi(left);
-                int r = std::stoi(right);
-                if (r == 0) throw std::runtime_error("Division by zero.");
-                return std::to_string(l / r);
-            }
-            if (binOp->op == "==") {
-                return (left == right) ? "true" : "false";
-            }
-            if (binOp->op == "!=") {
-                return (left != right) ? "true" : "false";
-            }
-            if (binOp->op == "<") {
-                return (left < right) ? "true" : "false";
-            }
-            if (binOp->op == ">") {
-                return (left > right) ? "true" : "false";
-            }
-            if (binOp->op == "<=") {
-                return (left <= right) ? "true" : "false";
-            }
-            if (binOp->op == ">=") {
-                return (left >= right) ? "true" : "false";
-            }
-            if (binOp->op == "&&") {
-                return (left == "true" && right == "true") ? "true" : "false";
-            }
-            if (binOp->op == "||") {
-                return (left == "true" || right == "true") ? "true" : "false";
-            }
-            throw std::runtime_error("Unknown binary operator '" + binOp->op + "'.");
+        if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(node)) {
+            if (funcCall->name != "len" && funcCall->name != "str" && funcCall->name != "int") return true;
+            return anyWrites(funcCall->args, name);
         }
-        if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(expr)) {
-            std::string operand = evaluate(unaryOp->operand);
-            if (unaryOp->op == "!") {
-                return (operand != "true") ? "true" : "false";
-            }
-            if (unaryOp->op == "-") {
-                int val = std::stoi(operand);
-                return std::to_string(-val);
+        if (std::dynamic_pointer_cast<ClassDeclaration>(node)) {
+            return true;
+        }
+        if (auto printStmt = std::dynamic_pointer_cast<PrintStatement>(node)) {
+            return mayWrite(printStmt->expression, name);
+        }
+        if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
+            return mayWrite(ifStmt->condition, name) || anyWrites(ifStmt->if_body, name) || anyWrites(ifStmt->else_body, name);
+        }
+        if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
+            return mayWrite(whileLoop->condition, name) || anyWrites(whileLoop->body, name);
+        }
+        if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
+            return mayWrite(forLoop->initialization, name) || mayWrite(forLoop->condition, name) ||
+                   mayWrite(forLoop->increment, name) || anyWrites(forLoop->body, name);
+        }
+        if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            // Gathered variables are assigned when the loop merges its results.
+            for (auto& reduction : forEach->reductions) {
+                if (reduction.name == name) return true;
             }
-            throw std::runtime_error("Unknown unary operator '" + unaryOp->op + "'.");
+            return forEach->name == name || mayWrite(forEach->items, name) || anyWrites(forEach->body, name);
         }
-        if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(expr)) {
-            executeFunctionCall(funcCall);
-            return "";
+        if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
+            return name == "error" || anyWrites(tryCatch->try_block, name) || anyWrites(tryCatch->catch_block, name);
         }
-        throw std::runtime_error("Unknown expression type.");
-    }
-
-    Token consume(TokenType type, const std::string& errorMessage) {
-        if (check(type)) {
-            return advance();
+        if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(node)) {
+            return mayWrite(binOp->left, name) || mayWrite(binOp->right, name);
         }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
+        if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(node)) {
+            return mayWrite(unaryOp->operand, name);
+        }
+        if (auto list = std::dynamic_pointer_cast<ListLiteral>(node)) {
+            return anyWrites(list->elements, name);
+        }
+        if (auto index = std::dynamic_pointer_cast<IndexExpression>(node)) {
+            return mayWrite(index->object, name) || mayWrite(index->index, name);
+        }
+        return false;
     }
 
-    Token consume(const std::string& expectedValue, const std::string& errorMessage) {
-        if (check(TokenType::OPERATOR, expectedValue)) {
-            return advance();
+    static bool anyWrites(const std::vector<ASTNodePtr>& nodes, const std::string& name) {
+        for (auto& node : nodes) {
+            if (mayWrite(node, name)) return true;
         }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
+        return false;
     }
 
-    Token consume(TokenType type, const std::string& value, const std::string& errorMessage) {
-        if (check(type, value)) {
-            return advance();
+    // Marks every 'list[var]' under node as unchecked. The body was proven
+    // free of writes, so nested blocks see the same 'list' and 'var'.
+    static void eliminateChecks(ASTNodePtr node, const std::string& list, const std::string& var) {
+        if (!node) return;
+        if (auto index = std::dynamic_pointer_cast<IndexExpression>(node)) {
+            if (isIdentifier(index->object, list) && isIdentifier(index->index, var)) {
+                index->bounds_checked = false;
+            }
+            eliminateChecks(index->object, list, var);
+            eliminateChecks(index->index, list, var);
+        }
+        else if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(node)) {
+            eliminateChecks(varDecl->value, list, var);
+        }
+        else if (auto assign = std::dynamic_pointer_cast<Assignment>(node)) {
+            eliminateChecks(assign->value, list, var);
+        }
+        else if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(node)) {
+            eliminateAll(funcCall->args, list, var);
+        }
+        else if (auto printStmt = std::dynamic_pointer_cast<PrintStatement>(node)) {
+            eliminateChecks(printStmt->expression, list, var);
+        }
+        else if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
+            eliminateChecks(ifStmt->condition, list, var);
+            eliminateAll(ifStmt->if_body, list, var);
+            eliminateAll(ifStmt->else_body, list, var);
+        }
+        else if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
+            eliminateChecks(whileLoop->condition, list, var);
+            eliminateAll(whileLoop->body, list, var);
+        }
+        else if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
+            eliminateChecks(forLoop->condition, list, var);
+            eliminateAll(forLoop->body, list, var);
+        }
+        else if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            eliminateChecks(forEach->items, list, var);
+            eliminateAll(forEach->body, list, var);
+        }
+        else if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
+            eliminateAll(tryCatch->try_block, list, var);
+            eliminateAll(tryCatch->catch_block, list, var);
+        }
+        else if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(node)) {
+            eliminateChecks(binOp->left, list, var);
+            eliminateChecks(binOp->right, list, var);
+        }
+        else if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(node)) {
+            eliminateChecks(unaryOp->operand, list, var);
+        }
+        else if (auto listLit = std::dynamic_pointer_cast<ListLiteral>(node)) {
+            eliminateAll(listLit->elements, list, var);
         }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
     }
 
-    Token consumeIdentifier(const std::string& errorMessage) {
-        if (check(TokenType::IDENTIFIER)) {
-            return advance();
+    static void eliminateAll(const std::vector<ASTNodePtr>& nodes, const std::string& list, const std::string& var) {
+        for (auto& node : nodes) {
+            eliminateChecks(node, list, var);
         }
-        throw std::runtime_error("Parser Error at line " + std::to_string(peek().line) + ", column " + std::to_string(peek().column) + ": " + errorMessage);
+    }
+};
+
+// ======================== Ifar Chain Dispatch ========================
+
+// Compiled form of a chain
+//
+//     Ifar x == c1 { ... } Elsear { Ifar x == c2 { ... } Elsear { ... } }
+//
+// that compares one variable against constants. Each link is the IfStatement
+// whose if_body runs on a match; the last link's else_body is the fallback.
+struct DispatchTable {
+    std::string subject;
+    Symbol subjectSymbol = nullptr;
+    std::vector<std::shared_ptr<IfStatement>> links;
+    std::unordered_map<std::string, size_t> cases;
+    // Integer constants in a dense range also get a direct jump table,
+    // holding a link index per value from 'base', or -1 for the fallback.
+    long base = 0;
+    std::vector<int> dense;
+
+    // Returns the link whose body runs for the subject's value, or nullptr
+    // for the fallback.
+    const IfStatement* select(const std::string& value) const {
+        long number;
+        if (!dense.empty() && parseCanonicalInt(value, number)) {
+            return selectDense(number);
+        }
+        auto it = cases.find(value);
+        return it == cases.end() ? nullptr : links[it->second].get();
+    }
+
+    // For integer subjects, which need no parsing or hashing when the table is dense.
+    const IfStatement* selectInt(long number) const {
+        if (!dense.empty()) return selectDense(number);
+        return select(std::to_string(number));
+    }
+
+    const IfStatement* selectDense(long number) const {
+        if (number < base || number - base >= static_cast<long>(dense.size())) return nullptr;
+        int link = dense[number - base];
+        return link < 0 ? nullptr : links[link].get();
+    }
+
+    IfStatement* fallback() const {
+        return links.back().get();
+    }
+
+    // Accepts only the spelling std::to_string produces, so the jump table
+    // agrees with the string '==' it replaces ("07" must not match 7).
+    static bool parseCanonicalInt(const std::string& value, long& number) {
+        size_t start = (!value.empty() && value[0] == '-') ? 1 : 0;
+        size_t digits = value.size() - start;
+        if (digits == 0 || digits > 18) return false;
+        if (value[start] == '0' && (digits > 1 || start == 1)) return false;
+        number = 0;
+        for (size_t i = start; i < value.size(); ++i) {
+            if (!std::isdigit(static_cast<unsigned char>(value[i]))) return false;
+            number = number * 10 + (value[i] - '0');
+        }
+        if (start == 1) number = -number;
+        return true;
+    }
+};
+
+// Finds Ifar/Elsear chains of at least two links that compare the same
+// variable against constants, and attaches a DispatchTable to their head so
+// selection is one hash or table lookup instead of a string '==' per link.
+class DispatchCompiler {
+public:
+    void compile(std::shared_ptr<Program> program) {
+        compileBlock(program->statements);
+    }
+
+private:
+    void compileBlock(const std::vector<ASTNodePtr>& statements) {
+        for (auto& stmt : statements) {
+            compileNode(stmt);
+        }
+    }
+
+    void compileNode(ASTNodePtr node) {
+        if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
+            compileChain(ifStmt);
+        }
+        else if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
+            compileBlock(whileLoop->body);
+        }
+        else if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
+            compileBlock(forLoop->body);
+        }
+        else if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            compileBlock(forEach->body);
+        }
+        else if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) {
+            compileBlock(funcDecl->body);
+        }
+        else if (auto classDecl = std::dynamic_pointer_cast<ClassDeclaration>(node)) {
+            compileBlock(classDecl->body);
+        }
+        else if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
+            compileBlock(tryCatch->try_block);
+            compileBlock(tryCatch->catch_block);
+        }
+    }
+
+    void compileChain(std::shared_ptr<IfStatement> head) {
+        auto table = std::make_shared<DispatchTable>();
+        std::vector<std::string> constants;
+        std::shared_ptr<IfStatement> link = head;
+        while (link) {
+            std::string subject, constant;
+            if (!matchComparison(link->condition, subject, constant)) break;
+            if (table->links.empty()) {
+                table->subject = subject;
+                table->subjectSymbol = intern(subject);
+            }
+            else if (subject != table->subject) break;
+            table->links.push_back(link);
+            constants.push_back(constant);
+            link = (link->else_body.size() == 1) ? std::dynamic_pointer_cast<IfStatement>(link->else_body[0]) : nullptr;
+        }
+        // A shorter chain still compiles; the first non-matching link becomes
+        // part of the fallback.
+        if (table->links.size() >= 2) {
+            for (size_t i = 0; i < constants.size(); ++i) {
+                // An earlier link wins for a repeated constant, as in the chain.
+                table->cases.emplace(constants[i], i);
+            }
+            buildDenseTable(*table, constants);
+            head->dispatch = table;
+        }
+        if (table->links.empty()) {
+            table->links.push_back(head);
+        }
+        for (auto& arm : table->links) {
+            compileBlock(arm->if_body);
+        }
+        compileBlock(table->fallback()->else_body);
+    }
+
+    // Matches 'x == <literal>' or '<literal> == x'.
+    static bool matchComparison(ASTNodePtr condition, std::string& subject, std::string& constant) {
+        auto binOp = std::dynamic_pointer_cast<BinaryOp>(condition);
+        if (!binOp || binOp->op != "==") return false;
+        auto ident = std::dynamic_pointer_cast<Identifier>(binOp->left);
+        ASTNodePtr other = binOp->right;
+        if (!ident) {
+            ident = std::dynamic_pointer_cast<Identifier>(binOp->right);
+            other = binOp->left;
+        }
+        if (!ident) return false;
+        subject = ident->name;
+        if (auto num = std::dynamic_pointer_cast<NumberLiteral>(other)) {
+            constant = std::to_string(num->value);
+            return true;
+        }
+        if (auto str = std::dynamic_pointer_cast<StringLiteral>(other)) {
+            constant = str->value;
+            return true;
+        }
+        return false;
+    }
+
+    // Uses a direct table when every constant is an integer and the range
+    // is at most twice the number of links.
+    static void buildDenseTable(DispatchTable& table, const std::vector<std::string>& constants) {
+        std::vector<long> numbers;
+        for (auto& constant : constants) {
+            long number;
+            if (!DispatchTable::parseCanonicalInt(constant, number)) return;
+            numbers.push_back(number);
+        }
+        long low = *std::min_element(numbers.begin(), numbers.end());
+        long high = *std::max_element(numbers.begin(), numbers.end());
+        if (high - low >= static_cast<long>(2 * numbers.size())) return;
+        table.base = low;
+        table.dense.assign(high - low + 1, -1);
+        for (size_t i = numbers.size(); i-- > 0;) {
+            table.dense[numbers[i] - low] = static_cast<int>(i);
+        }
+    }
+};
+
+// ======================== Compilation ========================
+
+// Lexes, parses and analyzes a program, which is final from then on; throws
+// the error to report.
+inline std::shared_ptr<const Program> compile(const std::string& code) {
+    auto symbols = std::make_shared<SymbolTable>();
+    SymbolTable::Scope scope(*symbols);
+    Lexer lexer(code);
+    TokenList tokens = lexer.tokenize();
+    Parser parser(tokens);
+    std::shared_ptr<Program> program = parser.parse();
+    program->symbols = symbols;
+    UpvalueResolver upvalueResolver(code);
+    upvalueResolver.resolve(program);
+    EscapeAnalyzer escapeAnalyzer;
+    escapeAnalyzer.analyze(program);
+    BoundsCheckEliminator boundsCheckEliminator;
+    boundsCheckEliminator.analyze(program);
+    DispatchCompiler dispatchCompiler;
+    dispatchCompiler.compile(program);
+    return program;
+}
+
+inline bool readSource(const std::string& path, std::string& code) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    code = buffer.str();
+    return true;
+}
+
+// ======================== Runtime Values ========================
+
+class Object;
+
+// A NaN-boxed 64-bit value. Doubles are stored as themselves, with every NaN
+// canonicalized to one quiet NaN. All other values live in the negative
+// quiet-NaN space as a 16-bit tag plus a 48-bit payload: signed integers,
+// booleans, nil, and pointers to reference-counted heap objects.
+class Value {
+public:
+    Value() : bits(kNil) {}
+    Value(const Value& other) : bits(other.bits) { retain(); }
+    Value(Value&& other) noexcept : bits(other.bits) { other.bits = kNil; }
+    ~Value() { release(); }
+
+    Value& operator=(const Value& other) {
+        if (bits != other.bits) {
+            Value copy(other);
+            std::swap(bits, copy.bits);
+        }
+        return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept {
+        std::swap(bits, other.bits);
+        return *this;
+    }
+
+    // Integers outside the 48-bit payload are kept whole in an IntegerObject.
+    static inline Value number(long long value);
+
+    // Whether number(value) is an immediate rather than an object.
+    static bool fitsInline(long long value) { return value >= kMinInt && value <= kMaxInt; }
+
+    static Value fromDouble(double value) {
+        if (value != value) return Value(kCanonicalNaN);
+        uint64_t raw;
+        std::memcpy(&raw, &value, sizeof(raw));
+        return Value(raw);
+    }
+
+    static Value boolean(bool value) {
+        return Value(kBoolTag | (value ? 1 : 0));
+    }
+
+    // Takes a new reference to 'object'.
+    static Value object(Object* object) {
+        Value value(kObjectTag | reinterpret_cast<uint64_t>(object));
+        value.retain();
+        return value;
+    }
+
+    bool isNil() const { return bits == kNil; }
+    bool isBool() const { return (bits & kTagMask) == kBoolTag; }
+    bool isInt() const { return (bits & kTagMask) == kIntTag || isWideInt(); }
+    bool isDouble() const { return (bits >> 48) < (kNil >> 48); }
+    bool isNumber() const { return isInt() || isDouble(); }
+    bool isObject() const { return (bits & kTagMask) == kObjectTag; }
+
+    long long asInt() const { return (bits & kTagMask) == kIntTag ? static_cast<long long>(bits << 16) >> 16 : wideInt(); }
+    bool asBool() const { return (bits & 1) != 0; }
+    Object* asObject() const { return reinterpret_cast<Object*>(bits & kPayloadMask); }
+
+    double asDouble() const {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    double toDouble() const { return isInt() ? static_cast<double>(asInt()) : asDouble(); }
+
+    // Identity: same immediate, same double bits, or same object.
+    bool same(const Value& other) const { return bits == other.bits; }
+
+private:
+    static constexpr uint64_t kTagMask = 0xFFFF000000000000ULL;
+    static constexpr uint64_t kPayloadMask = 0x0000FFFFFFFFFFFFULL;
+    static constexpr uint64_t kNil = 0xFFF9000000000000ULL;
+    static constexpr uint64_t kBoolTag = 0xFFFA000000000000ULL;
+    static constexpr uint64_t kIntTag = 0xFFFB000000000000ULL;
+    static constexpr uint64_t kObjectTag = 0xFFFC000000000000ULL;
+    static constexpr uint64_t kCanonicalNaN = 0x7FF8000000000000ULL;
+    static constexpr long long kMinInt = -(1LL << 47);
+    static constexpr long long kMaxInt = (1LL << 47) - 1;
+
+    uint64_t bits;
+
+    explicit Value(uint64_t bits) : bits(bits) {}
+
+    inline bool isWideInt() const;
+    inline long long wideInt() const;
+    inline void retain();
+    inline void release();
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay one 64-bit word");
+
+using Box = std::shared_ptr<Value>;
+
+enum class ObjectKind {
+    String,
+    Cauldron,
+    Incantation,
+    Builtin,
+    Creature,
+    // A number or boolean that had to be boxed to fit a compressed Slot.
+    Boxed,
+    Channel,
+    Worker,
+    // A SharedSpellBook: a dictionary isolates share.
+    Book,
+    // An integer too wide for a Value's 48-bit payload.
+    Integer
+};
+
+#ifdef SPELL_POINTER_COMPRESSION
+// A contiguous reservation of up to 4 GB owned by one interpreter. Every heap
+// object of that interpreter lives inside it, so an object is named by its
+// 32-bit offset from the cage base. Only Cauldron Slots use such offsets;
+// scopes hold full Values, and Shared SpellBooks live outside any cage. Pages are committed as the bump pointer
+// reaches them; freed blocks go to per-size free lists threaded through the
+// blocks themselves.
+class HeapCage {
+public:
+    static constexpr size_t kReservation = size_t(1) << 32;
+    static constexpr size_t kGranule = 16;
+    static constexpr size_t kCommitChunk = size_t(1) << 20;
+
+    HeapCage() {
+        void* memory = mmap(nullptr, kReservation, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("Could not reserve the heap cage.");
+        }
+        base = static_cast<char*>(memory);
+        // Offsets below one granule are never objects; Slot uses them for immediates.
+        top = kGranule;
+    }
+
+    ~HeapCage() {
+        munmap(base, kReservation);
+    }
+
+    HeapCage(const HeapCage&) = delete;
+    HeapCage& operator=(const HeapCage&) = delete;
+
+    void* allocate(size_t size) {
+        size_t sizeClass = (size + kGranule - 1) / kGranule;
+        if (sizeClass < freeLists.size() && freeLists[sizeClass] != 0) {
+            uint32_t offset = freeLists[sizeClass];
+            std::memcpy(&freeLists[sizeClass], base + offset, sizeof(uint32_t));
+            return base + offset;
+        }
+        size_t bytes = sizeClass * kGranule;
+        if (top + bytes > kReservation) {
+            throw std::runtime_error("Heap cage exhausted.");
+        }
+        if (top + bytes > committed) {
+            size_t extent = std::min(kReservation, (top + bytes + kCommitChunk - 1) / kCommitChunk * kCommitChunk);
+            if (mprotect(base + committed, extent - committed, PROT_READ | PROT_WRITE) != 0) {
+                throw std::runtime_error("Could not commit heap cage memory.");
+            }
+            committed = extent;
+        }
+        void* block = base + top;
+        top += bytes;
+        return block;
+    }
+
+    void free(void* block, size_t size) {
+        size_t sizeClass = (size + kGranule - 1) / kGranule;
+        if (sizeClass >= freeLists.size()) freeLists.resize(sizeClass + 1, 0);
+        std::memcpy(block, &freeLists[sizeClass], sizeof(uint32_t));
+        freeLists[sizeClass] = offsetOf(block);
+    }
+
+    uint32_t offsetOf(const void* block) const {
+        return static_cast<uint32_t>(static_cast<const char*>(block) - base);
+    }
+
+    void* at(uint32_t offset) const {
+        return base + offset;
+    }
+
+    // The cage objects are currently allocated in and decompressed against.
+    static HeapCage*& current() {
+        static thread_local HeapCage* cage = nullptr;
+        return cage;
+    }
+
+    // Makes a cage current for the lifetime of the scope.
+    class Scope {
+    public:
+        explicit Scope(HeapCage& cage) : previous(current()) { current() = &cage; }
+        ~Scope() { current() = previous; }
+    private:
+        HeapCage* previous;
+    };
+
+private:
+    char* base;
+    size_t top;
+    size_t committed = 0;
+    std::vector<uint32_t> freeLists;
+};
+#endif
+
+// Heap objects are reference counted by the Values that point at them.
+// Counts are not atomic: an object never leaves the interpreter that made it.
+class Object {
+public:
+    ObjectKind kind;
+    uint32_t refs = 0;
+    explicit Object(ObjectKind kind) : kind(kind) {}
+    virtual ~Object() = default;
+
+#ifdef SPELL_POINTER_COMPRESSION
+    static void* operator new(size_t size) {
+        HeapCage* cage = HeapCage::current();
+        if (cage == nullptr) throw std::runtime_error("No heap cage is active.");
+        return cage->allocate(size);
+    }
+
+    static void operator delete(void* block, size_t size) {
+        HeapCage::current()->free(block, size);
+    }
+#endif
+};
+
+class BoxedObject : public Object {
+public:
+    Value value;
+    explicit BoxedObject(Value value) : Object(ObjectKind::Boxed), value(std::move(value)) {}
+};
+
+class IntegerObject : public Object {
+public:
+    long long value;
+    explicit IntegerObject(long long value) : Object(ObjectKind::Integer), value(value) {}
+};
+
+inline Value Value::number(long long value) {
+    if (!fitsInline(value)) return Value::object(new IntegerObject(value));
+    return Value(kIntTag | (static_cast<uint64_t>(value) & kPayloadMask));
+}
+
+inline bool Value::isWideInt() const {
+    return isObject() && asObject()->kind == ObjectKind::Integer;
+}
+
+inline long long Value::wideInt() const {
+    return static_cast<IntegerObject*>(asObject())->value;
+}
+
+#ifdef SPELL_POINTER_COMPRESSION
+// A Value stored in a heap container, compressed to 32 bits: a 31-bit small
+// integer when the low bit is set, otherwise a cage offset. Offsets below one
+// granule encode nil and the booleans; doubles and wider integers are boxed.
+class Slot {
+public:
+    Slot(const Value& value) : word(compress(value)) {}
+    Slot(const Slot& other) : word(other.word) { retain(); }
+    Slot(Slot&& other) noexcept : word(other.word) { other.word = kNil; }
+    ~Slot() { release(); }
+
+    Slot& operator=(const Slot& other) {
+        Slot copy(other);
+        std::swap(word, copy.word);
+        return *this;
+    }
+
+    // True for small integers, nil and the booleans, which name no object.
+    bool immediate() const {
+        return (word & 1) || word < HeapCage::kGranule;
+    }
+
+    Value get() const {
+        if (word & 1) return Value::number(static_cast<int32_t>(word) >> 1);
+        if (word == kNil) return Value();
+        if (word == kFalse || word == kTrue) return Value::boolean(word == kTrue);
+        Object* object = static_cast<Object*>(HeapCage::current()->at(word));
+        if (object->kind == ObjectKind::Boxed) return static_cast<BoxedObject*>(object)->value;
+        return Value::object(object);
+    }
+
+private:
+    static constexpr uint32_t kNil = 0;
+    static constexpr uint32_t kFalse = 2;
+    static constexpr uint32_t kTrue = 4;
+
+    uint32_t word;
+
+    static uint32_t compress(const Value& value) {
+        if (value.isInt() && value.asInt() >= INT32_MIN / 2 && value.asInt() <= INT32_MAX / 2) {
+            return (static_cast<uint32_t>(value.asInt()) << 1) | 1;
+        }
+        if (value.isNil()) return kNil;
+        if (value.isBool()) return value.asBool() ? kTrue : kFalse;
+        Object* object = value.isObject() ? value.asObject() : new BoxedObject(value);
+        object->refs++;
+        return HeapCage::current()->offsetOf(object);
+    }
+
+    Object* object() const {
+        if ((word & 1) || word < HeapCage::kGranule) return nullptr;
+        return static_cast<Object*>(HeapCage::current()->at(word));
+    }
+
+    void retain() {
+        if (Object* o = object()) o->refs++;
+    }
+
+    void release() {
+        Object* o = object();
+        if (o && --o->refs == 0) delete o;
+    }
+};
+
+static_assert(sizeof(Slot) == 4, "A compressed Slot must stay 32 bits");
+#else
+// A Value stored in a heap container. Without pointer compression it is the
+// Value itself.
+class Slot {
+public:
+    Slot(Value value) : value(std::move(value)) {}
+    bool immediate() const { return !value.isObject(); }
+    const Value& get() const { return value; }
+
+private:
+    Value value;
+};
+#endif
+
+class StringObject : public Object {
+public:
+    std::string value;
+    explicit StringObject(std::string value) : Object(ObjectKind::String), value(std::move(value)) {}
+};
+
+class ListObject : public Object {
+public:
+    std::vector<Slot> elements;
+    explicit ListObject(std::vector<Slot> elements) : Object(ObjectKind::Cauldron), elements(std::move(elements)) {}
+};
+
+// An Incantation value: the declaration plus the boxes of its upvalues, in
+// the order of FunctionDeclaration::upvalues.
+class ClosureObject : public Object {
+public:
+    const FunctionDeclaration* decl;
+    std::vector<Box> upvalues;
+    explicit ClosureObject(const FunctionDeclaration* decl) : Object(ObjectKind::Incantation), decl(decl) {}
+};
+
+class BuiltinObject : public Object {
+public:
+    std::string name;
+    explicit BuiltinObject(std::string name) : Object(ObjectKind::Builtin), name(std::move(name)) {}
+};
+
+class CreatureObject : public Object {
+public:
+    const ClassDeclaration* decl;
+    explicit CreatureObject(const ClassDeclaration* decl) : Object(ObjectKind::Creature), decl(decl) {}
+};
+
+inline void Value::retain() {
+    if (isObject()) asObject()->refs++;
+}
+
+inline void Value::release() {
+    if (isObject() && --asObject()->refs == 0) delete asObject();
+}
+
+inline bool isKind(const Value& value, ObjectKind kind) {
+    return value.isObject() && value.asObject()->kind == kind;
+}
+
+inline Value makeString(std::string text) {
+    return Value::object(new StringObject(std::move(text)));
+}
+
+inline const std::string& stringOf(const Value& value) {
+    return static_cast<StringObject*>(value.asObject())->value;
+}
+
+inline ListObject* listOf(const Value& value) {
+    return static_cast<ListObject*>(value.asObject());
+}
+
+// Whole-string base-10 integer; false for anything else, including overflow.
+inline bool parseInteger(const std::string& text, long long& result) {
+    const char* end = text.data() + text.size();
+    auto parsed = std::from_chars(text.data(), end, result);
+    return parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+inline std::string formatInteger(long long value) {
+    char buffer[24];
+    return std::string(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+// The shortest spelling that reads back as the same double.
+inline std::string formatDouble(double value) {
+    char buffer[32];
+    return std::string(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+// The text form of a value: what Illuminate prints and what '+' concatenates.
+inline std::string toText(const Value& value) {
+    if (value.isInt()) return formatInteger(value.asInt());
+    if (value.isDouble()) return formatDouble(value.asDouble());
+    if (value.isBool()) return value.asBool() ? "true" : "false";
+    if (value.isNil()) return "";
+    switch (value.asObject()->kind) {
+        case ObjectKind::String:
+            return stringOf(value);
+        case ObjectKind::Cauldron: {
+            std::string result = "[";
+            const auto& elements = listOf(value)->elements;
+            for (size_t i = 0; i < elements.size(); ++i) {
+                if (i != 0) result += ", ";
+                result += toText(elements[i].get());
+            }
+            return result + "]";
+        }
+        case ObjectKind::Incantation:
+            return "Function";
+        case ObjectKind::Builtin:
+            return "Builtin";
+        case ObjectKind::Creature:
+            return "Class";
+        case ObjectKind::Boxed:
+            return toText(static_cast<BoxedObject*>(value.asObject())->value);
+        case ObjectKind::Channel:
+            return "Channel";
+        case ObjectKind::Worker:
+            return "Worker";
+        case ObjectKind::Book:
+            return "SpellBooks";
+        case ObjectKind::Integer:
+            return formatInteger(value.asInt());
+    }
+    return "";
+}
+
+// Conditions hold for true, and for values spelled "true" or "1".
+inline bool truthy(const Value& value) {
+    if (value.isBool()) return value.asBool();
+    if (value.isInt()) return value.asInt() == 1;
+    if (isKind(value, ObjectKind::String)) return stringOf(value) == "true" || stringOf(value) == "1";
+    return value.isDouble() && value.asDouble() == 1.0;
+}
+
+// '==' compares text forms; non-string objects compare by identity.
+inline bool valuesEqual(const Value& left, const Value& right) {
+    if (left.isInt() && right.isInt()) return left.asInt() == right.asInt();
+    bool leftRef = left.isObject() && !left.isInt() && !isKind(left, ObjectKind::String);
+    bool rightRef = right.isObject() && !right.isInt() && !isKind(right, ObjectKind::String);
+    if (leftRef || rightRef) return left.same(right);
+    if (isKind(left, ObjectKind::String) && isKind(right, ObjectKind::String)) return stringOf(left) == stringOf(right);
+    return toText(left) == toText(right);
+}
+
+// Shared string values for the most common results: the empty string, every
+// single character, and the text of small integers. Numbers and booleans are
+// immediates and never allocate. Entries are created on first use, so an idle
+// interpreter pays only for the table.
+class StringCache {
+public:
+    static constexpr long long kMinInt = -128;
+    static constexpr long long kMaxInt = 1023;
+
+    Value string(std::string text) {
+        if (text.empty()) return cached(empty, text);
+        if (text.size() == 1) return cached(characters[static_cast<unsigned char>(text[0])], text);
+        return makeString(std::move(text));
+    }
+
+    // The string value of 'value', as the str spell produces it.
+    Value textOf(const Value& value) {
+        if (isKind(value, ObjectKind::String)) return value;
+        if (value.isInt() && value.asInt() >= kMinInt && value.asInt() <= kMaxInt) {
+            Value& slot = integers[value.asInt() - kMinInt];
+            if (slot.isNil()) slot = makeString(toText(value));
+            return slot;
+        }
+        if (value.isBool()) return cached(booleans[value.asBool()], toText(value));
+        return string(toText(value));
+    }
+
+    void clear() {
+        empty = Value();
+        for (auto& value : characters) value = Value();
+        for (auto& value : integers) value = Value();
+        for (auto& value : booleans) value = Value();
+    }
+
+private:
+    Value empty;
+    Value characters[256];
+    Value integers[kMaxInt - kMinInt + 1];
+    Value booleans[2];
+
+    static Value cached(Value& slot, std::string text) {
+        if (slot.isNil()) slot = makeString(std::move(text));
+        return slot;
+    }
+};
+
+// ======================== Isolates ========================
+
+class Channel;
+class ConcurrentBook;
+
+// A value on its way from one interpreter to another. Objects never cross
+// interpreters, so a message carries what they hold and the receiver builds
+// its own: strings and Cauldrons are rebuilt in its heap, and Channels and
+// SharedSpellBooks, the only shared objects, travel as themselves.
+class Message {
+public:
+    enum class Kind { Immediate, Integer, String, Cauldron, Channel, Book };
+
+    Kind kind = Kind::Immediate;
+    Value immediate;
+    // An integer too wide to be an immediate, which would be an object.
+    long long integer = 0;
+    std::string text;
+    // A Cauldron of immediates keeps its storage; any other carries each
+    // element as a message.
+    std::vector<Slot> slots;
+    std::vector<Message> elements;
+    std::shared_ptr<Channel> channel;
+    std::shared_ptr<ConcurrentBook> book;
+
+    // Copies 'value' and everything in it; the sender's value is untouched.
+    static inline Message copy(const Value& value);
+
+    // Copies a value the caller hands over. When nothing else refers to it,
+    // its own storage is moved instead; its elements are copied all the same,
+    // as the sender may still hold them.
+    static inline Message take(Value value);
+
+    // Hands over the storage of a Cauldron of numbers, which is left empty,
+    // or of a string nothing else refers to. Strings are immutable, so one
+    // still referred to elsewhere is copied.
+    static inline Message transfer(Value value);
+
+    // A number, as an immediate or a wide integer.
+    static inline Message number(long long value);
+
+    // Builds the value in the current interpreter.
+    inline Value receive() &&;
+};
+
+// A bounded lock-free ring of messages between isolates, in two variants:
+// many senders and one receiver, or a single sender and receiver. Each cell
+// carries a sequence number that says whether it is free for the sender at
+// that position or filled for the receiver, so the only contended write is
+// the senders' claim of the tail, which the single-sender variant makes a
+// plain store. A side waits on its futex only when the ring is empty or
+// full, after a short spin. Once closed, the receiver drains what is left
+// and then gets nil. Each side is claimed by the first thread to use it.
+class Channel {
+public:
+    Channel(size_t capacity, bool singleSender) : singleSender(singleSender) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    void send(Message message) {
+        claim(sender, singleSender, "A Pipe has a single sender.");
+        for (;;) {
+            if (closed.load(std::memory_order_acquire)) throw std::runtime_error("Send on a closed Channel.");
+            for (int spin = 0; spin < kSpins; ++spin) {
+                if (tryPush(message)) {
+                    readable.signal();
+                    return;
+                }
+            }
+            uint32_t seen = writable.prepare();
+            if (tryPush(message)) {
+                writable.cancel();
+                readable.signal();
+                return;
+            }
+            if (closed.load(std::memory_order_acquire)) {
+                writable.cancel();
+                continue;
+            }
+            writable.wait(seen);
+        }
+    }
+
+    // False once the channel is closed and drained.
+    bool receive(Message& message) {
+        claim(receiver, true, "A Channel has a single receiver.");
+        for (;;) {
+            for (int spin = 0; spin < kSpins; ++spin) {
+                if (tryPop(message)) {
+                    writable.signal();
+                    return true;
+                }
+            }
+            uint32_t seen = readable.prepare();
+            if (tryPop(message)) {
+                readable.cancel();
+                writable.signal();
+                return true;
+            }
+            // A sender that claimed a cell before the close is still writing it.
+            if (closed.load(std::memory_order_acquire) && tail.load(std::memory_order_acquire) == head) {
+                readable.cancel();
+                return false;
+            }
+            readable.wait(seen);
+        }
+    }
+
+    void close() {
+        closed.store(true, std::memory_order_release);
+        readable.signal(INT32_MAX);
+        writable.signal(INT32_MAX);
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Message message;
+    };
+
+    static constexpr int kSpins = 64;
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    bool singleSender;
+    std::atomic<bool> closed{false};
+    std::atomic<std::thread::id> sender{};
+    std::atomic<std::thread::id> receiver{};
+    // The senders' and the receiver's ends sit on cache lines of their own.
+    alignas(64) std::atomic<size_t> tail{0};
+    WaitPoint writable;
+    alignas(64) size_t head = 0;
+    WaitPoint readable;
+
+    static void claim(std::atomic<std::thread::id>& side, bool single, const char* violation) {
+        if (!single) return;
+        std::thread::id self = std::this_thread::get_id();
+        std::thread::id owner = side.load(std::memory_order_relaxed);
+        if (owner == self) return;
+        if (owner == std::thread::id() && side.compare_exchange_strong(owner, self)) return;
+        if (owner == self) return;
+        throw std::runtime_error(violation);
+    }
+
+    bool tryPush(Message& message) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            auto lag = static_cast<std::ptrdiff_t>(sequence - position);
+            if (lag < 0) return false;
+            if (lag > 0) {
+                position = tail.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (singleSender) {
+                tail.store(position + 1, std::memory_order_relaxed);
+                break;
+            }
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        }
+        cell->message = std::move(message);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(Message& message) {
+        Cell& cell = cells[head & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != head + 1) return false;
+        message = std::move(cell.message);
+        cell.message = Message();
+        cell.sequence.store(head + mask + 1, std::memory_order_release);
+        ++head;
+        return true;
+    }
+};
+
+// A dictionary shared by isolates, with entries held as messages. Keys hash
+// to one of kStripes stripes, each a table under a lock of its own, so
+// operations on different stripes never contend. Lookups copy the entry out
+// under the lock; the caller builds the value in its own heap.
+class ConcurrentBook {
+public:
+    static constexpr size_t kStripes = 64;
+
+    // False if 'key' already had an entry, which is left as it was.
+    bool insertIfAbsent(const std::string& key, Message value) {
+        Stripe& stripe = stripeOf(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        return stripe.entries.emplace(key, std::move(value)).second;
+    }
+
+    bool lookup(const std::string& key, Message& value) const {
+        const Stripe& stripe = stripeOf(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        auto it = stripe.entries.find(key);
+        if (it == stripe.entries.end()) return false;
+        value = it->second;
+        return true;
+    }
+
+    // Adds 'amount' to the number under 'key', where a missing entry counts
+    // as 0, and returns the sum. Integers that overflow become doubles.
+    Value increment(const std::string& key, const Value& amount) {
+        Stripe& stripe = stripeOf(key);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        Message& entry = stripe.entries[key];
+        // Entries hold no objects, so a wide integer is kept as one.
+        bool wide = entry.kind == Message::Kind::Integer;
+        Value current = wide ? Value() : entry.kind == Message::Kind::Immediate && entry.immediate.isNil() ? Value::number(0) : entry.immediate;
+        if (!wide && (entry.kind != Message::Kind::Immediate || !current.isNumber())) {
+            throw std::runtime_error("Cannot increment '" + key + "': it does not hold a number.");
+        }
+        bool integral = wide || current.isInt();
+        long long base = wide ? entry.integer : integral ? current.asInt() : 0;
+        long long sum;
+        if (integral && amount.isInt() && !__builtin_add_overflow(base, amount.asInt(), &sum)) {
+            entry = Message::number(sum);
+            return Value::number(sum);
+        }
+        double total = (integral ? static_cast<double>(base) : current.toDouble()) + amount.toDouble();
+        entry = Message();
+        entry.immediate = Value::fromDouble(total);
+        return entry.immediate;
+    }
+
+    // A snapshot of the keys, in order.
+    std::vector<std::string> keys() const {
+        std::vector<std::string> result;
+        for (auto& stripe : stripes) {
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            for (auto& entry : stripe.entries) result.push_back(entry.first);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (auto& stripe : stripes) {
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            total += stripe.entries.size();
+        }
+        return total;
+    }
+
+private:
+    // Stripes sit on cache lines of their own.
+    struct alignas(64) Stripe {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Message> entries;
+    };
+
+    std::array<Stripe, kStripes> stripes;
+
+    Stripe& stripeOf(const std::string& key) {
+        return stripes[(std::hash<std::string>()(key) * 0x9E3779B97F4A7C15ULL) >> 58];
+    }
+
+    const Stripe& stripeOf(const std::string& key) const {
+        return const_cast<ConcurrentBook*>(this)->stripeOf(key);
+    }
+};
+
+static_assert(ConcurrentBook::kStripes == 64, "stripeOf takes the top 6 bits of the hash");
+
+class BookObject : public Object {
+public:
+    std::shared_ptr<ConcurrentBook> book;
+    explicit BookObject(std::shared_ptr<ConcurrentBook> book) : Object(ObjectKind::Book), book(std::move(book)) {}
+};
+
+class ChannelObject : public Object {
+public:
+    std::shared_ptr<Channel> channel;
+    explicit ChannelObject(std::shared_ptr<Channel> channel) : Object(ObjectKind::Channel), channel(std::move(channel)) {}
+};
+
+// A summoned isolate: a thread running one Incantation in an interpreter of
+// its own. 'error' and 'output' are read only after the thread is joined.
+class Worker {
+public:
+    std::thread thread;
+    bool failed = false;
+    bool awaited = false;
+    std::string error;
+    // Everything it printed, when output is ordered.
+    std::string output;
+};
+
+class WorkerObject : public Object {
+public:
+    std::shared_ptr<Worker> worker;
+    explicit WorkerObject(std::shared_ptr<Worker> worker) : Object(ObjectKind::Worker), worker(std::move(worker)) {}
+};
+
+// The iterations of one parallel Forar, split into chunks that workers run
+// in isolates of their own. Workers read the plan and write only their
+// chunks' entries.
+struct Swarm {
+    static constexpr size_t kChunksPerWorker = 8;
+
+    const ForEachLoop* loop;
+    std::vector<std::shared_ptr<const Program>> programs;
+    // A Cauldron of immediates is read in place; any other is handed out
+    // element by element, each to the one chunk that iterates it.
+    Message items;
+    size_t count = 0;
+    size_t chunkSize = 1;
+    // The variables the body takes from outside, and the values min and max
+    // reductions start from.
+    std::vector<std::pair<Symbol, Message>> shared;
+    std::vector<Message> starts;
+    // Per chunk: the reductions' results, or the error that stopped it, and
+    // what it printed when output is ordered.
+    std::vector<std::vector<Message>> partials;
+    std::vector<std::string> errors;
+    std::vector<std::string> outputs;
+    // Chunks after the first failed one are skipped.
+    std::atomic<size_t> firstFailure{SIZE_MAX};
+
+    size_t chunks() const { return (count + chunkSize - 1) / chunkSize; }
+
+    void fail(size_t chunk, std::string error) {
+        errors[chunk] = std::move(error);
+        size_t failed = firstFailure.load();
+        while (chunk < failed && !firstFailure.compare_exchange_weak(failed, chunk)) {
+        }
+    }
+};
+
+inline Message Message::copy(const Value& value) {
+    Message message;
+    if (!value.isObject()) {
+        message.immediate = value;
+        return message;
+    }
+    Object* object = value.asObject();
+    switch (object->kind) {
+        case ObjectKind::String: {
+            message.kind = Kind::String;
+            message.text = static_cast<StringObject*>(object)->value;
+            return message;
+        }
+        case ObjectKind::Cauldron: {
+            auto& elements = listOf(value)->elements;
+            message.kind = Kind::Cauldron;
+            if (std::all_of(elements.begin(), elements.end(), [](const Slot& slot) { return slot.immediate(); })) {
+                message.slots = elements;
+                return message;
+            }
+            message.elements.reserve(elements.size());
+            for (auto& element : elements) message.elements.push_back(copy(element.get()));
+            return message;
+        }
+        case ObjectKind::Boxed:
+            return copy(static_cast<BoxedObject*>(object)->value);
+        case ObjectKind::Integer:
+            return number(value.asInt());
+        case ObjectKind::Channel:
+            message.kind = Kind::Channel;
+            message.channel = static_cast<ChannelObject*>(object)->channel;
+            return message;
+        case ObjectKind::Book:
+            message.kind = Kind::Book;
+            message.book = static_cast<BookObject*>(object)->book;
+            return message;
+        default:
+            throw std::runtime_error("A " + toText(value) + " cannot be sent to another isolate.");
+    }
+}
+
+inline Message Message::number(long long value) {
+    Message message;
+    if (Value::fitsInline(value)) {
+        message.immediate = Value::number(value);
+    }
+    else {
+        message.kind = Kind::Integer;
+        message.integer = value;
+    }
+    return message;
+}
+
+inline Message Message::take(Value value) {
+    if (!value.isObject() || value.asObject()->refs != 1) return copy(value);
+    if (isKind(value, ObjectKind::String)) {
+        Message message;
+        message.kind = Kind::String;
+        message.text = std::move(static_cast<StringObject*>(value.asObject())->value);
+        return message;
+    }
+    if (isKind(value, ObjectKind::Cauldron)) {
+        auto& elements = listOf(value)->elements;
+        if (std::all_of(elements.begin(), elements.end(), [](const Slot& slot) { return slot.immediate(); })) {
+            Message message;
+            message.kind = Kind::Cauldron;
+            message.slots = std::move(elements);
+            return message;
+        }
+    }
+    return copy(value);
+}
+
+inline Message Message::transfer(Value value) {
+    if (isKind(value, ObjectKind::String)) return take(std::move(value));
+    if (isKind(value, ObjectKind::Cauldron)) {
+        auto& elements = listOf(value)->elements;
+        if (std::all_of(elements.begin(), elements.end(), [](const Slot& slot) { return slot.get().isNumber(); })) {
+            Message message;
+            message.kind = Kind::Cauldron;
+            if (std::all_of(elements.begin(), elements.end(), [](const Slot& slot) { return slot.immediate(); })) {
+                message.slots = std::move(elements);
+            }
+            else {
+                // Compressed heaps box wide numbers, which are copied one by one.
+                for (auto& element : elements) message.elements.push_back(copy(element.get()));
+            }
+            elements.clear();
+            return message;
+        }
+    }
+    throw std::runtime_error("Only strings and Cauldrons of numbers can be transferred.");
+}
+
+inline Value Message::receive() && {
+    switch (kind) {
+        case Kind::Immediate:
+            return immediate;
+        case Kind::Integer:
+            return Value::number(integer);
+        case Kind::String:
+            return makeString(std::move(text));
+        case Kind::Cauldron: {
+            if (elements.empty()) return Value::object(new ListObject(std::move(slots)));
+            std::vector<Slot> built;
+            built.reserve(elements.size());
+            for (auto& element : elements) built.push_back(std::move(element).receive());
+            return Value::object(new ListObject(std::move(built)));
+        }
+        case Kind::Channel:
+            return Value::object(new ChannelObject(std::move(channel)));
+        case Kind::Book:
+            return Value::object(new BookObject(std::move(book)));
+    }
+    return Value();
+}
+
+// ======================== Output ========================
+
+// Writes everything Illuminate prints, on a thread of its own. Interpreters
+// collect their lines in an Output buffer and hand whole buffers over
+// through a lock-free channel, so a printing thread never takes a lock or
+// waits on the terminal, and lines from different threads never mix. The
+// process's writer prints to stdout and stderr; the daemon has one per
+// connection handler, pointed at each client's own in turn.
+class OutputWriter {
+public:
+    // Set before any interpreter runs: the output of each parallel task is
+    // held and placed in task order, so a script prints the same lines in
+    // the same order on every run. Forar Geminio prints in element order,
+    // and a summoned worker's output appears where it is awaited.
+    bool ordered = false;
+
+    OutputWriter() {
+        redirect(kStdout, kStderr, false);
+    }
+
+    static OutputWriter& instance() {
+        static OutputWriter writer;
+        return writer;
+    }
+
+    ~OutputWriter() {
+        if (!writer.joinable()) return;
+        queue.close();
+        writer.join();
+    }
+
+    // Points the writer at other descriptors. Only while nothing is
+    // printing: everything written before goes to the old ones.
+    void redirect(int out, int err, bool orderOutput) {
+        drain();
+        outFd = out;
+        errFd = err;
+        ordered = orderOutput;
+#ifdef __linux__
+        terminal = isatty(out);
+#endif
+    }
+
+    // Whether output goes to a terminal, and so a line at a time.
+    bool lineBuffered() const {
+        return terminal;
+    }
+
+    void write(std::string text) {
+        std::call_once(started, [this] { writer = std::thread([this] { writeLoop(); }); });
+        // Counted before it is queued; see drain().
+        sent.fetch_add(1);
+        Message message;
+        message.kind = Message::Kind::String;
+        message.text = std::move(text);
+        queue.send(std::move(message));
+    }
+
+    // Writes a diagnostic once everything queued so far is written.
+    void error(const std::string& line) {
+        drain();
+        writeAll(errFd, line + "\n");
+    }
+
+    // Waits until everything queued so far is written. Every buffer counted
+    // in 'sent' by then is queued no later than the caller's own, so once
+    // that many are written the caller's are too.
+    void drain() {
+        uint64_t target = sent.load();
+        while (written.load() < target) {
+            uint32_t seen = drained.prepare();
+            if (written.load() >= target) {
+                drained.cancel();
+                break;
+            }
+            drained.wait(seen);
+        }
+    }
+
+private:
+    static constexpr size_t kQueueCapacity = 256;
+    static constexpr int kStdout = 1;
+    static constexpr int kStderr = 2;
+
+    Channel queue{kQueueCapacity, false};
+    std::once_flag started;
+    std::thread writer;
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> written{0};
+    WaitPoint drained;
+    int outFd;
+    int errFd;
+    bool terminal = false;
+
+    void writeLoop() {
+        Message message;
+        while (queue.receive(message)) {
+            writeAll(outFd, message.text);
+            written.fetch_add(1);
+            drained.signal(INT32_MAX);
+        }
+    }
+
+    // A reader that went away loses the rest; the script still runs to its end.
+    static void writeAll(int fd, const std::string& text) {
+#ifdef __linux__
+        const char* data = text.data();
+        size_t left = text.size();
+        while (left > 0) {
+            ssize_t count = ::write(fd, data, left);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return;
+            data += count;
+            left -= static_cast<size_t>(count);
+        }
+#else
+        std::ostream& stream = fd == kStderr ? std::cerr : std::cout;
+        stream.write(text.data(), text.size());
+        stream.flush();
+#endif
+    }
+};
+
+// One interpreter's pending output. Like stdio, it goes out a line at a
+// time to a terminal and in large blocks otherwise. A capturing buffer
+// keeps its text for the caller to place; see OutputWriter::ordered.
+class Output {
+public:
+    static constexpr size_t kBlockSize = size_t(64) << 10;
+
+    OutputWriter& writer;
+    bool capturing = false;
+
+    explicit Output(OutputWriter& writer) : writer(writer) {}
+
+    void print(const std::string& line) {
+        text += line;
+        text += '\n';
+        if (!capturing && (writer.lineBuffered() || text.size() >= kBlockSize)) flush();
+    }
+
+    // Places captured output from elsewhere as if printed here.
+    void append(const std::string& captured) {
+        text += captured;
+        if (!capturing && (writer.lineBuffered() || text.size() >= kBlockSize)) flush();
+    }
+
+    void flush() {
+        if (capturing || text.empty()) return;
+        writer.write(std::move(text));
+        text.clear();
+    }
+
+    // Reports an error after everything printed so far.
+    void error(const std::string& line) {
+        flush();
+        writer.error(line);
+    }
+
+    std::string take() {
+        std::string captured = std::move(text);
+        text.clear();
+        return captured;
+    }
+
+private:
+    std::string text;
+};
+
+// ======================== Interpreter Definitions ========================
+
+class Environment;
+using EnvPtr = std::shared_ptr<Environment>;
+
+// A scope's variables. Most scopes hold a handful of names, so bindings sit
+// inline and are searched linearly by symbol; a scope that outgrows the
+// inline slots moves them to a hash table.
+class Environment {
+public:
+    EnvPtr enclosing;
+
+    Environment() : enclosing(nullptr) {}
+    Environment(EnvPtr enclosing) : enclosing(enclosing) {}
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
+
+    // Drops all variables so a frame scope can be reused by the next loop iteration.
+    void reset() {
+        for (size_t i = 0; i < count; ++i) {
+            slots[i] = Binding();
+        }
+        count = 0;
+        table.reset();
+    }
+
+    void define(Symbol name, Value value) {
+        Binding* binding = find(name);
+        if (binding == nullptr) binding = insert(name);
+        // A redeclaration is a new variable; closures keep the old box.
+        binding->box.reset();
+        binding->value = std::move(value);
+    }
+
+    // Makes a closure's upvalue visible in this (call) scope.
+    void bind(Symbol name, Box box) {
+        Binding* binding = find(name);
+        if (binding == nullptr) binding = insert(name);
+        binding->value = Value();
+        binding->box = std::move(box);
+    }
+
+    // Returns the box for a variable, moving it out of its unboxed slot the
+    // first time it is captured.
+    Box capture(Symbol name) {
+        Binding* binding = lookup(name);
+        if (!binding->box) {
+            binding->box = std::make_shared<Value>(std::move(binding->value));
+        }
+        return binding->box;
+    }
+
+    bool contains(Symbol name) const {
+        for (const Environment* env = this; env != nullptr; env = env->enclosing.get()) {
+            if (env->find(name) != nullptr) return true;
+        }
+        return false;
+    }
+
+    void assign(Symbol name, Value value) {
+        lookup(name)->slot() = std::move(value);
+    }
+
+    const Value& get(Symbol name) const {
+        return lookup(name)->slot();
+    }
+
+private:
+    struct Binding {
+        Symbol name = nullptr;
+        Value value;
+        // Set once a closure captures the variable; 'value' is then unused.
+        Box box;
+
+        Value& slot() { return box ? *box : value; }
+    };
+
+    static constexpr size_t kInlineSlots = 4;
+
+    Binding slots[kInlineSlots];
+    size_t count = 0;
+    std::unique_ptr<std::unordered_map<Symbol, Binding>> table;
+
+    Binding* find(Symbol name) const {
+        if (table) {
+            auto it = table->find(name);
+            return it == table->end() ? nullptr : &it->second;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (slots[i].name == name) return const_cast<Binding*>(&slots[i]);
+        }
+        return nullptr;
+    }
+
+    Binding* insert(Symbol name) {
+        if (!table && count < kInlineSlots) {
+            slots[count].name = name;
+            return &slots[count++];
+        }
+        if (!table) {
+            table = std::make_unique<std::unordered_map<Symbol, Binding>>();
+            for (size_t i = 0; i < count; ++i) {
+                (*table)[slots[i].name] = std::move(slots[i]);
+                slots[i] = Binding();
+            }
+            count = 0;
+        }
+        Binding& binding = (*table)[name];
+        binding.name = name;
+        return &binding;
+    }
+
+    Binding* lookup(Symbol name) const {
+        for (const Environment* env = this; env != nullptr; env = env->enclosing.get()) {
+            if (Binding* binding = env->find(name)) return binding;
+        }
+        throw std::runtime_error("Undefined variable '" + *name + "'.");
+    }
+};
+
+class Interpreter {
+#ifdef SPELL_POINTER_COMPRESSION
+    // Declared first so it outlives every object allocated in it.
+    HeapCage cage;
+#endif
+
+public:
+    EnvPtr globals;
+    EnvPtr environment;
+
+    explicit Interpreter(OutputWriter& writer = OutputWriter::instance()) : output(writer) {
+#ifdef SPELL_POINTER_COMPRESSION
+        HeapCage::Scope scope(cage);
+#endif
+        globals = std::make_shared<Environment>();
+        environment = globals;
+        defineBuiltIns();
+        builtins = globals;
+    }
+
+    ~Interpreter() {
+        joinWorkers();
+        output.flush();
+#ifdef SPELL_POINTER_COMPRESSION
+        // Objects must be released while their cage is current.
+        HeapCage::Scope scope(cage);
+        literals.clear();
+        cauldrons.clear();
+        strings.clear();
+        environment.reset();
+        globals.reset();
+        builtins.reset();
+#endif
+    }
+
+    void interpret(std::shared_ptr<const Program> program) {
+#ifdef SPELL_POINTER_COMPRESSION
+        HeapCage::Scope scope(cage);
+#endif
+        // The interpreter walks the tree through borrowed references, and its
+        // closures point into it, so every program it ran stays alive with it.
+        programs.push_back(program);
+        try {
+            for (auto& stmt : program->statements) {
+                execute(*stmt);
+            }
+        }
+        catch (const std::runtime_error& e) {
+            output.error(std::string("Runtime Error: ") + e.what());
+        }
+        output.flush();
+    }
+
+    // Binds the script's command-line arguments, as strings, to the Cauldron
+    // 'Arguments'.
+    void bindArguments(const std::vector<std::string>& arguments) {
+#ifdef SPELL_POINTER_COMPRESSION
+        HeapCage::Scope scope(cage);
+#endif
+        std::vector<Slot> slots;
+        for (auto& argument : arguments) slots.push_back(strings.string(argument));
+        static const Symbol name = intern("Arguments");
+        globals->define(name, Value::object(new ListObject(std::move(slots))));
+    }
+
+    // Runs 'program' for one record of a batch, over fresh globals that hold
+    // the record's fields in front of the builtins. Nothing the record before
+    // defined is visible, yet the builtins and materialized literals are kept.
+    // Returns what the program printed; a runtime error is left in 'error'.
+    std::string runRecord(const std::shared_ptr<const Program>& program, std::vector<std::pair<Symbol, Message>> record,
+                          std::string& error) {
+#ifdef SPELL_POINTER_COMPRESSION
+        HeapCage::Scope scope(cage);
+#endif
+        if (programs.empty() || programs.back() != program) programs.push_back(program);
+        output.capturing = true;
+        globals = std::make_shared<Environment>(builtins);
+        environment = globals;
+        try {
+            for (auto& field : record) {
+                globals->define(field.first, std::move(field.second).receive());
+            }
+            for (auto& stmt : program->statements) {
+                execute(*stmt);
+            }
+        }
+        catch (const std::runtime_error& e) {
+            error = e.what();
+        }
+        joinWorkers();
+        // Dropping the record's scope releases everything it made.
+        globals = builtins;
+        environment = globals;
+        return output.take();
+    }
+
+private:
+    // The scope the builtins are defined in; see runRecord.
+    EnvPtr builtins;
+    std::vector<std::shared_ptr<const Program>> programs;
+    // String literals are materialized once per interpreter.
+    std::unordered_map<const StringLiteral*, Value> literals;
+    // The Cauldron of each reusable Cauldron literal; see evaluateReusable.
+    std::unordered_map<const ListLiteral*, Value> cauldrons;
+    StringCache strings;
+    std::vector<std::shared_ptr<Worker>> workers;
+    Output output;
+    // Set in the isolates of a parallel Forar. One that meets another Forar
+    // Geminio runs its chunks itself, one after another, rather than start a
+    // pool of its own on every core.
+    bool swarmWorker = false;
+
+    // Summoned workers run on their own, and are waited for at the end.
+    void joinWorkers() {
+        for (auto& worker : workers) {
+            join(*worker);
+            if (worker->awaited) continue;
+            output.append(worker->output);
+            if (worker->failed) output.error("Runtime Error: " + worker->error);
+        }
+        workers.clear();
+    }
+
+    // Runs 'decl' as a summoned isolate.
+    void runIsolate(std::vector<std::shared_ptr<const Program>> shared, const FunctionDeclaration& decl, Message argument,
+                    Worker& worker) {
+#ifdef SPELL_POINTER_COMPRESSION
+        HeapCage::Scope scope(cage);
+#endif
+        output.capturing = output.writer.ordered;
+        try {
+            declareShared(std::move(shared));
+            Value closure = Value::object(new ClosureObject(&decl));
+            Environment frame(globals);
+            EnvPtr callEnv = scopeFor(ScopeKind::Frame, frame);
+            callEnv->define(decl.paramSymbols[0], std::move(argument).receive());
+            enterClosure(static_cast<ClosureObject*>(closure.asObject()), callEnv);
+        }
+        catch (const std::runtime_error& e) {
+            worker.failed = true;
+            worker.error = e.what();
+        }
+        // Its own workers' output belongs to its own.
+        joinWorkers();
+        if (output.capturing) worker.output = output.take();
+    }
+
+    // Declares the programs' top-level Incantations and Creatures; nothing
+    // else of them runs here.
+    void declareShared(std::vector<std::shared_ptr<const Program>> shared) {
+        programs = std::move(shared);
+        for (auto& program : programs) {
+            for (auto& stmt : program->statements) {
+                if (dynamic_cast<const FunctionDeclaration*>(stmt.get()) || dynamic_cast<const ClassDeclaration*>(stmt.get())) {
+                    execute(*stmt);
+                }
+            }
+        }
+    }
+
+    // Starts 'function' on a thread with an interpreter of its own, passing it
+    // 'argument'. No state is shared with the new isolate but Channels.
+    Value summon(const Value& function, Message argument) {
+        if (!isKind(function, ObjectKind::Incantation)) {
+            throw std::runtime_error("Only an Incantation can be summoned.");
+        }
+        auto closure = static_cast<ClosureObject*>(function.asObject());
+        const FunctionDeclaration* decl = closure->decl;
+        if (!closure->upvalues.empty()) {
+            throw std::runtime_error("Incantation '" + decl->name + "' captures variables and cannot be summoned.");
+        }
+        if (decl->params.size() != 1) {
+            throw std::runtime_error("Incantation '" + decl->name + "' expects " + std::to_string(decl->params.size()) +
+                                     " arguments but got 1.");
+        }
+        // What was printed before the worker started comes first.
+        output.flush();
+        auto worker = std::make_shared<Worker>();
+        worker->thread = std::thread([worker, &writer = output.writer, shared = programs, decl,
+                                      argument = std::move(argument)]() mutable {
+            Interpreter isolate(writer);
+            isolate.runIsolate(std::move(shared), *decl, std::move(argument), *worker);
+        });
+        workers.push_back(worker);
+        return Value::object(new WorkerObject(worker));
+    }
+
+    static void join(Worker& worker) {
+        if (worker.thread.joinable()) worker.thread.join();
+    }
+
+    static ConcurrentBook& bookOf(const Value& value) {
+        if (!isKind(value, ObjectKind::Book)) {
+            throw std::runtime_error("Expected a SharedSpellBook but got '" + toText(value) + "'.");
+        }
+        return *static_cast<BookObject*>(value.asObject())->book;
+    }
+
+    static Channel& channelOf(const Value& value) {
+        if (!isKind(value, ObjectKind::Channel)) {
+            throw std::runtime_error("Expected a Channel but got '" + toText(value) + "'.");
+        }
+        return *static_cast<ChannelObject*>(value.asObject())->channel;
+    }
+
+    void execute(const ASTNode& node) {
+        if (auto varDecl = dynamic_cast<const VarDeclaration*>(&node)) {
+            executeVarDeclaration(*varDecl);
+        }
+        else if (auto assign = dynamic_cast<const Assignment*>(&node)) {
+            executeAssignment(*assign);
+        }
+        else if (auto funcDecl = dynamic_cast<const FunctionDeclaration*>(&node)) {
+            executeFunctionDeclaration(*funcDecl);
+        }
+        else if (auto funcCall = dynamic_cast<const FunctionCall*>(&node)) {
+            executeFunctionCall(*funcCall);
+        }
+        else if (auto printStmt = dynamic_cast<const PrintStatement*>(&node)) {
+            executePrintStatement(*printStmt);
+        }
+        else if (auto ifStmt = dynamic_cast<const IfStatement*>(&node)) {
+            executeIfStatement(*ifStmt);
+        }
+        else if (auto whileLoop = dynamic_cast<const WhileLoop*>(&node)) {
+            executeWhileLoop(*whileLoop);
+        }
+        else if (auto forLoop = dynamic_cast<const ForLoop*>(&node)) {
+            executeForLoop(*forLoop);
+        }
+        else if (auto forEach = dynamic_cast<const ForEachLoop*>(&node)) {
+            executeForEachLoop(*forEach);
+        }
+        else if (auto classDecl = dynamic_cast<const ClassDeclaration*>(&node)) {
+            executeClassDeclaration(*classDecl);
+        }
+        else if (auto tryCatch = dynamic_cast<const TryCatch*>(&node)) {
+            executeTryCatch(*tryCatch);
+        }
+        else {
+            throw std::runtime_error("Unknown AST node type.");
+        }
+    }
+
+    void executeVarDeclaration(const VarDeclaration& varDecl) {
+        environment->define(varDecl.symbol, evaluate(*varDecl.value));
+    }
+
+    void executeAssignment(const Assignment& assign) {
+        environment->assign(assign.symbol, evaluate(*assign.value));
+    }
+
+    void executeFunctionDeclaration(const FunctionDeclaration& funcDecl) {
+        // Define the name first so a local Incantation can capture itself.
+        environment->define(funcDecl.symbol, Value());
+        auto closure = new ClosureObject(&funcDecl);
+        Value value = Value::object(closure);
+        for (Symbol name : funcDecl.upvalueSymbols) {
+            closure->upvalues.push_back(environment->capture(name));
+        }
+        environment->assign(funcDecl.symbol, value);
+    }
+
+    void executeFunctionCall(const FunctionCall& funcCall) {
+        callFunction(funcCall);
+    }
+
+    // For simplicity, handle built-in functions and user-defined functions
+    Value callFunction(const FunctionCall& funcCall) {
+        if (!environment->contains(funcCall.symbol)) {
+            output.print("Function '" + funcCall.name + "' is not defined.");
+            return Value();
+        }
+        Value func = environment->get(funcCall.symbol);
+        if (isKind(func, ObjectKind::Incantation)) {
+            callClosure(static_cast<ClosureObject*>(func.asObject()), funcCall);
+            return Value();
+        }
+        if (isKind(func, ObjectKind::Builtin)) {
+            return callBuiltin(funcCall);
+        }
+        // Handle other built-in functions
+        output.print("Function call: " + funcCall.name);
+        return Value();
+    }
+
+    // Runs the body in a flat scope over the globals: parameters are plain
+    // slots and upvalues are the captured boxes, so the defining Environment
+    // chain is neither kept alive nor searched.
+    void callClosure(ClosureObject* closure, const FunctionCall& funcCall) {
+        const FunctionDeclaration* decl = closure->decl;
+        if (funcCall.args.size() != decl->params.size()) {
+            throw std::runtime_error("Incantation '" + decl->name + "' expects " + std::to_string(decl->params.size()) +
+                                     " arguments but got " + std::to_string(funcCall.args.size()) + ".");
+        }
+        Environment frame(globals);
+        EnvPtr callEnv = scopeFor(ScopeKind::Frame, frame);
+        for (size_t i = 0; i < decl->params.size(); ++i) {
+            callEnv->define(decl->paramSymbols[i], evaluate(*funcCall.args[i]));
+        }
+        enterClosure(closure, callEnv);
+    }
+
+    // Binds the upvalues in the call scope, which holds the arguments, and
+    // runs the body there.
+    void enterClosure(ClosureObject* closure, EnvPtr callEnv) {
+        const FunctionDeclaration* decl = closure->decl;
+        for (size_t i = 0; i < decl->upvalues.size(); ++i) {
+            callEnv->bind(decl->upvalueSymbols[i], closure->upvalues[i]);
+        }
+        executeBlock(decl->body, callEnv);
+    }
+
+    Value callBuiltin(const FunctionCall& funcCall) {
+        const std::string& name = funcCall.name;
+        size_t arity = arityOf(name);
+        if (funcCall.args.size() != arity) {
+            throw std::runtime_error("Spell '" + name + "' expects " + std::to_string(arity) +
+                                     (arity == 1 ? " argument." : " arguments."));
+        }
+        if (name == "SharedSpellBook") {
+            return Value::object(new BookObject(std::make_shared<ConcurrentBook>()));
+        }
+        Value arg = evaluate(*funcCall.args[0]);
+        if (name == "len") {
+            if (isKind(arg, ObjectKind::Cauldron)) return Value::number(listOf(arg)->elements.size());
+            if (isKind(arg, ObjectKind::Book)) return Value::number(bookOf(arg).size());
+            if (isKind(arg, ObjectKind::String)) return Value::number(stringOf(arg).size());
+            return Value::number(toText(arg).size());
+        }
+        if (name == "int") {
+            return Value::number(toInteger(arg));
+        }
+        if (name == "str") {
+            return strings.textOf(arg);
+        }
+        if (name == "Channel" || name == "Pipe") {
+            long long capacity = toInteger(arg);
+            if (capacity < 1) throw std::runtime_error("A " + name + " needs a capacity of at least 1.");
+            return Value::object(new ChannelObject(std::make_shared<Channel>(capacity, name == "Pipe")));
+        }
+        if (name == "Send" || name == "Transfer") {
+            Channel& channel = channelOf(arg);
+            Value value = evaluate(*funcCall.args[1]);
+            if (name == "Send") {
+                channel.send(Message::take(std::move(value)));
+                return Value();
+            }
+            // A string variable is left empty, like a Cauldron, and gives up
+            // its reference, so a string it alone held moves.
+            auto variable = dynamic_cast<const Identifier*>(funcCall.args[1].get());
+            if (variable && isKind(value, ObjectKind::String)) environment->assign(variable->symbol, strings.string(""));
+            channel.send(Message::transfer(std::move(value)));
+            return Value();
+        }
+        if (name == "Receive") {
+            Message message;
+            if (!channelOf(arg).receive(message)) return Value();
+            return std::move(message).receive();
+        }
+        if (name == "Close") {
+            channelOf(arg).close();
+            return Value();
+        }
+        if (name == "Summon") {
+            return summon(arg, Message::take(evaluate(*funcCall.args[1])));
+        }
+        if (name == "Inscribe") {
+            ConcurrentBook& book = bookOf(arg);
+            std::string key = toText(evaluate(*funcCall.args[1]));
+            return Value::boolean(book.insertIfAbsent(key, Message::copy(evaluate(*funcCall.args[2]))));
+        }
+        if (name == "Increment") {
+            ConcurrentBook& book = bookOf(arg);
+            std::string key = toText(evaluate(*funcCall.args[1]));
+            Value amount = evaluate(*funcCall.args[2]);
+            if (!amount.isNumber()) amount = Value::number(toInteger(amount));
+            return book.increment(key, amount);
+        }
+        if (name == "Keys") {
+            std::vector<Slot> keys;
+            for (auto& key : bookOf(arg).keys()) keys.push_back(strings.string(std::move(key)));
+            return Value::object(new ListObject(std::move(keys)));
+        }
+        // Await
+        if (!isKind(arg, ObjectKind::Worker)) {
+            throw std::runtime_error("Expected a Worker but got '" + toText(arg) + "'.");
+        }
+        Worker& worker = *static_cast<WorkerObject*>(arg.asObject())->worker;
+        join(worker);
+        if (!worker.awaited) output.append(worker.output);
+        worker.awaited = true;
+        if (worker.failed) throw std::runtime_error("Worker failed: " + worker.error);
+        return Value();
+    }
+
+    static size_t arityOf(const std::string& name) {
+        if (name == "SharedSpellBook") return 0;
+        if (name == "Inscribe" || name == "Increment") return 3;
+        if (name == "Send" || name == "Transfer" || name == "Summon") return 2;
+        return 1;
+    }
+
+    // The integer '-', '*', '/', int() and indexes work with. Only they read a
+    // string spelled as an integer as its number; '+' and the comparisons
+    // take strings as text.
+    static long long toInteger(const Value& value) {
+        long long result;
+        if (value.isInt()) return value.asInt();
+        if (value.isDouble()) return static_cast<long long>(value.asDouble());
+        if (!isKind(value, ObjectKind::String) || !parseInteger(stringOf(value), result)) {
+            throw std::runtime_error("Expected a number but got '" + toText(value) + "'.");
+        }
+        return result;
+    }
+
+    void executePrintStatement(const PrintStatement& printStmt) {
+        Value value = evaluate(*printStmt.expression);
+        output.print(toText(value));
+    }
+
+    void executeIfStatement(const IfStatement& ifStmt) {
+        if (ifStmt.dispatch) {
+            executeDispatch(*ifStmt.dispatch);
+            return;
+        }
+        bool condition = truthy(evaluate(*ifStmt.condition));
+        Environment frame(environment);
+        if (condition) {
+            executeBlock(ifStmt.if_body, scopeFor(ifStmt.if_scope, frame));
+        }
+        else {
+            executeBlock(ifStmt.else_body, scopeFor(ifStmt.else_scope, frame));
+        }
+    }
+
+    void executeDispatch(const DispatchTable& table) {
+        const Value& subject = environment->get(table.subjectSymbol);
+        const IfStatement* link = nullptr;
+        if (subject.isInt()) {
+            link = table.selectInt(subject.asInt());
+        }
+        else if (isKind(subject, ObjectKind::String)) {
+            link = table.select(stringOf(subject));
+        }
+        else if (!subject.isObject()) {
+            link = table.select(toText(subject));
+        }
+        Environment frame(environment);
+        if (link) {
+            executeBlock(link->if_body, scopeFor(link->if_scope, frame));
+        }
+        else {
+            const IfStatement* fallback = table.fallback();
+            executeBlock(fallback->else_body, scopeFor(fallback->else_scope, frame));
+        }
+    }
+
+    void executeWhileLoop(const WhileLoop& whileLoop) {
+        // One frame scope serves every iteration.
+        Environment frame(environment);
+        while (truthy(evaluate(*whileLoop.condition))) {
+            executeBlock(whileLoop.body, scopeFor(whileLoop.body_scope, frame));
+        }
+    }
+
+    void executeForLoop(const ForLoop& forLoop) {
+        // An undeclared loop variable lives in the loop's own scope.
+        Environment header(environment);
+        EnvPtr outer = environment;
+        environment = scopeFor(ScopeKind::Frame, header);
+        try {
+            runForLoop(forLoop);
+        }
+        catch (...) {
+            environment = outer;
+            throw;
+        }
+        environment = outer;
+    }
+
+    void runForLoop(const ForLoop& forLoop) {
+        // Execute initialization
+        auto init = dynamic_cast<const Assignment*>(forLoop.initialization.get());
+        if (init && !environment->contains(init->symbol)) {
+            environment->define(init->symbol, evaluate(*init->value));
+        }
+        else {
+            execute(*forLoop.initialization);
+        }
+        // A proven counted loop evaluates its len() bound once.
+        long long bound = 0;
+        if (forLoop.invariant_bound) {
+            bound = toInteger(evaluate(*static_cast<const BinaryOp&>(*forLoop.condition).right));
+        }
+        Environment frame(environment);
+        while (true) {
+            if (forLoop.invariant_bound) {
+                auto& cond = static_cast<const BinaryOp&>(*forLoop.condition);
+                if (toInteger(evaluate(*cond.left)) >= bound) break;
+            }
+            else if (!truthy(evaluate(*forLoop.condition))) {
+                break;
+            }
+            executeBlock(forLoop.body, scopeFor(forLoop.body_scope, frame));
+            // Execute increment
+            execute(*forLoop.increment);
+        }
+    }
+
+    void executeForEachLoop(const ForEachLoop& forEach) {
+        Value items = evaluate(*forEach.items);
+        if (!isKind(items, ObjectKind::Cauldron)) {
+            throw std::runtime_error("Forar needs a Cauldron but got '" + toText(items) + "'.");
+        }
+        for (auto& reduction : forEach.reductions) {
+            environment->get(reduction.symbol);
+        }
+        if (forEach.parallel) {
+            runSwarm(forEach, items);
+            return;
+        }
+        // The loop variable lives in the loop's own scope.
+        Environment header(environment);
+        EnvPtr outer = environment;
+        environment = loopScope(forEach, header);
+        try {
+            Environment frame(environment);
+            // By index: the body may Transfer the Cauldron away.
+            auto& elements = listOf(items)->elements;
+            for (size_t i = 0; i < elements.size(); ++i) {
+                environment->define(forEach.symbol, elements[i].get());
+                executeBlock(forEach.body, scopeFor(forEach.body_scope, frame));
+            }
+        }
+        catch (...) {
+            environment = outer;
+            throw;
+        }
+        environment = outer;
+    }
+
+    // A body scope that escapes keeps the loop variable's scope alive with it.
+    EnvPtr loopScope(const ForEachLoop& forEach, Environment& header) {
+        return scopeFor(forEach.body_scope == ScopeKind::Heap ? ScopeKind::Heap : ScopeKind::Frame, header);
+    }
+
+    // Runs a parallel Forar. The iterations are split into chunks for a
+    // work-stealing pool of isolates, which see copies of the variables the
+    // body uses from outside and give each chunk private reduction variables;
+    // the chunks' results are merged into the variables in iteration order.
+    // An error stops the loop as it would in order, at the first failing
+    // iteration.
+    void runSwarm(const ForEachLoop& loop, const Value& items) {
+        Swarm swarm;
+        swarm.loop = &loop;
+        swarm.count = listOf(items)->elements.size();
+        if (swarm.count == 0) return;
+        swarm.programs = programs;
+        // Copied, never moved: the loop leaves its Cauldron and the variables
+        // it shares as they were.
+        swarm.items = Message::copy(items);
+        for (Symbol name : loop.sharedSymbols) {
+            if (!environment->contains(name)) continue;
+            Value value = environment->get(name);
+            if (isKind(value, ObjectKind::Builtin)) continue;
+            if (isKind(value, ObjectKind::Incantation) || isKind(value, ObjectKind::Creature)) {
+                // Workers declare the top-level ones themselves.
+                if (globals->contains(name) && globals->get(name).asObject() == value.asObject()) continue;
+                throw std::runtime_error("Forar Geminio cannot share '" + *name +
+                                         "' with its workers; only top-level Incantations and Creatures can be used there.");
+            }
+            swarm.shared.emplace_back(name, Message::copy(value));
+        }
+        for (auto& reduction : loop.reductions) {
+            bool keepsStart = reduction.kind == Reduction::Kind::Min || reduction.kind == Reduction::Kind::Max;
+            swarm.starts.push_back(keepsStart ? Message::copy(environment->get(reduction.symbol)) : Message());
+        }
+
+        unsigned workers = swarmWorker ? 1 : std::max(1u, std::thread::hardware_concurrency());
+        size_t chunks = std::min(swarm.count, static_cast<size_t>(workers) * Swarm::kChunksPerWorker);
+        swarm.chunkSize = (swarm.count + chunks - 1) / chunks;
+        swarm.partials.resize(swarm.chunks());
+        swarm.errors.resize(swarm.chunks());
+        swarm.outputs.resize(swarm.chunks());
+        output.flush();
+        std::vector<std::unique_ptr<Interpreter>> isolates(workers);
+        stealingFor(swarm.chunks(), workers, [&](size_t chunk, unsigned worker) {
+            if (chunk > swarm.firstFailure.load()) return;
+            try {
+                if (!isolates[worker]) {
+                    auto isolate = std::make_unique<Interpreter>(output.writer);
+                    isolate->joinSwarm(swarm);
+                    isolates[worker] = std::move(isolate);
+                }
+                isolates[worker]->runSwarmChunk(swarm, chunk);
+            }
+            catch (const std::runtime_error& e) {
+                swarm.fail(chunk, e.what());
+            }
+        });
+        // Ordered output is what the loop would print in order, up to the error.
+        size_t failure = swarm.firstFailure.load();
+        for (size_t chunk = 0; chunk < swarm.chunks() && chunk <= failure; ++chunk) {
+            output.append(swarm.outputs[chunk]);
+        }
+        if (failure != SIZE_MAX) {
+            throw std::runtime_error(swarm.errors[failure]);
+        }
+
+        for (size_t i = 0; i < loop.reductions.size(); ++i) {
+            const Reduction& reduction = loop.reductions[i];
+            Value result = environment->get(reduction.symbol);
+            std::string text = reduction.kind == Reduction::Kind::Concat ? toText(result) : std::string();
+            for (auto& partial : swarm.partials) {
+                Value value = std::move(partial[i]).receive();
+                switch (reduction.kind) {
+                    case Reduction::Kind::Sum:
+                        result = add(result, value);
+                        break;
+                    case Reduction::Kind::Min:
+                        if (compareValues(value, result) < 0) result = value;
+                        break;
+                    case Reduction::Kind::Max:
+                        if (compareValues(value, result) > 0) result = value;
+                        break;
+                    case Reduction::Kind::Concat:
+                        text += toText(value);
+                        break;
+                }
+            }
+            if (reduction.kind == Reduction::Kind::Concat) result = strings.string(std::move(text));
+            environment->assign(reduction.symbol, result);
+        }
+    }
+
+    // Prepares this isolate to run chunks of a parallel Forar.
+    void joinSwarm(const Swarm& swarm) {
+#ifdef SPELL_POINTER_COMPRESSION
+        HeapCage::Scope scope(cage);
+#endif
+        output.capturing = output.writer.ordered;
+        swarmWorker = true;
+        declareShared(swarm.programs);
+        for (auto& entry : swarm.shared) {
+            globals->define(entry.first, Message(entry.second).receive());
+        }
+    }
+
+    // Runs one chunk of a parallel Forar's iterations and records what the
+    // reductions gathered over it.
+    void runSwarmChunk(Swarm& swarm, size_t chunk) {
+#ifdef SPELL_POINTER_COMPRESSION
+        HeapCage::Scope scope(cage);
+#endif
+        const ForEachLoop& loop = *swarm.loop;
+        for (size_t i = 0; i < loop.reductions.size(); ++i) {
+            const Reduction& reduction = loop.reductions[i];
+            Value start;
+            if (reduction.kind == Reduction::Kind::Sum) start = Value::number(0);
+            else if (reduction.kind == Reduction::Kind::Concat) start = strings.string("");
+            else start = Message(swarm.starts[i]).receive();
+            globals->define(reduction.symbol, std::move(start));
+        }
+        Environment header(globals);
+        environment = loopScope(loop, header);
+        try {
+            Environment frame(environment);
+            size_t begin = chunk * swarm.chunkSize;
+            size_t end = std::min(swarm.count, begin + swarm.chunkSize);
+            for (size_t i = begin; i < end; ++i) {
+                Value item = swarm.items.slots.empty() ? std::move(swarm.items.elements[i]).receive() : swarm.items.slots[i].get();
+                environment->define(loop.symbol, std::move(item));
+                executeBlock(loop.body, scopeFor(loop.body_scope, frame));
+            }
+        }
+        catch (...) {
+            environment = globals;
+            if (output.capturing) swarm.outputs[chunk] = output.take();
+            throw;
+        }
+        environment = globals;
+        if (output.capturing) swarm.outputs[chunk] = output.take();
+        std::vector<Message> gathered;
+        for (auto& reduction : loop.reductions) {
+            gathered.push_back(Message::copy(globals->get(reduction.symbol)));
+        }
+        swarm.partials[chunk] = std::move(gathered);
+    }
+
+    void executeClassDeclaration(const ClassDeclaration& classDecl) {
+        environment->define(classDecl.symbol, Value::object(new CreatureObject(&classDecl)));
+    }
+
+    void executeTryCatch(const TryCatch& tryCatch) {
+        Environment frame(environment);
+        try {
+            executeBlock(tryCatch.try_block, scopeFor(tryCatch.try_scope, frame));
+        }
+        catch (const std::runtime_error& e) {
+            EnvPtr catchEnv = scopeFor(tryCatch.catch_scope, frame);
+            // Define 'error' variable
+            catchEnv->define(tryCatch.errorSymbol, strings.string(e.what()));
+            executeBlock(tryCatch.catch_block, catchEnv);
+        }
+    }
+
+    // Returns the scope a block of the given kind runs in. Frame scopes are the
+    // caller's stack-allocated 'frame', handed out through a non-owning EnvPtr;
+    // the escape analysis guarantees nothing retains them.
+    EnvPtr scopeFor(ScopeKind kind, Environment& frame) {
+        switch (kind) {
+            case ScopeKind::None:
+                return environment;
+            case ScopeKind::Frame:
+                frame.reset();
+                return EnvPtr(EnvPtr(), &frame);
+            default:
+                return std::make_shared<Environment>(environment);
+        }
+    }
+
+    void executeBlock(const std::vector<ASTNodePtr>& statements, EnvPtr env) {
+        // 'env' holds the caller's scope while the block runs; swapping
+        // leaves both reference counts untouched.
+        environment.swap(env);
+        try {
+            for (auto& stmt : statements) {
+                execute(*stmt);
+            }
+        }
+        catch (...) {
+            environment.swap(env);
+            throw;
+        }
+        environment.swap(env);
+    }
+
+    Value evaluateIndex(const IndexExpression& index) {
+        Value object = evaluate(*index.object);
+        Value position = evaluate(*index.index);
+        if (isKind(object, ObjectKind::Book)) {
+            // A missing key gives nothing.
+            Message entry;
+            if (!bookOf(object).lookup(toText(position), entry)) return Value();
+            return std::move(entry).receive();
+        }
+        if (!isKind(object, ObjectKind::Cauldron)) {
+            throw std::runtime_error("Only a Cauldron can be indexed.");
+        }
+        const auto& elements = listOf(object)->elements;
+        long long i = toInteger(position);
+        if (!index.bounds_checked) {
+            return elements[i].get();
+        }
+        if (i < 0 || static_cast<size_t>(i) >= elements.size()) {
+            throw std::runtime_error("Cauldron index " + toText(position) + " is out of range.");
+        }
+        return elements[i].get();
+    }
+
+    // A Cauldron literal the escape analysis proved never outlives its use
+    // refills the Cauldron of its last evaluation, keeping its storage, once
+    // nothing else holds it. Otherwise (when it is still in use further up
+    // a recursion, say) it gets a new one.
+    Value evaluateReusable(const ListLiteral& list) {
+        Value& cached = cauldrons[&list];
+        if (cached.isNil() || cached.asObject()->refs != 1) {
+            cached = Value::object(new ListObject({}));
+        }
+        // Held while it is filled, so an element that evaluates this same
+        // literal cannot refill it.
+        Value cauldron = cached;
+        auto& elements = listOf(cauldron)->elements;
+        elements.clear();
+        elements.reserve(list.elements.size());
+        for (auto& element : list.elements) {
+            elements.push_back(evaluate(*element));
+        }
+        return cauldron;
+    }
+
+    // Integer arithmetic that overflows 64 bits falls back to doubles.
+    static Value arithmetic(const std::string& op, const Value& left, const Value& right) {
+        if (left.isDouble() || right.isDouble()) {
+            double l = left.isNumber() ? left.toDouble() : static_cast<double>(toInteger(left));
+            double r = right.isNumber() ? right.toDouble() : static_cast<double>(toInteger(right));
+            if (op == "+") return Value::fromDouble(l + r);
+            if (op == "-") return Value::fromDouble(l - r);
+            if (op == "*") return Value::fromDouble(l * r);
+            if (r == 0) throw std::runtime_error("Division by zero.");
+            return Value::fromDouble(l / r);
+        }
+        long long l = toInteger(left);
+        long long r = toInteger(right);
+        long long result;
+        if (op == "+") {
+            if (__builtin_add_overflow(l, r, &result)) return Value::fromDouble(static_cast<double>(l) + r);
+        }
+        else if (op == "-") {
+            if (__builtin_sub_overflow(l, r, &result)) return Value::fromDouble(static_cast<double>(l) - r);
+        }
+        else if (op == "*") {
+            if (__builtin_mul_overflow(l, r, &result)) return Value::fromDouble(static_cast<double>(l) * r);
+        }
+        else {
+            if (r == 0) throw std::runtime_error("Division by zero.");
+            if (r == -1) return arithmetic("-", Value::number(0), left);
+            result = l / r;
+        }
+        return Value::number(result);
+    }
+
+    // Numbers add, everything else concatenates: "1" + "2" is "12".
+    Value add(const Value& left, const Value& right) {
+        if (left.isNumber() && right.isNumber()) return arithmetic("+", left, right);
+        return strings.string(toText(left) + toText(right));
+    }
+
+    // Numbers compare numerically, everything else lexicographically: "10" < "9".
+    static int compareValues(const Value& left, const Value& right) {
+        if (left.isNumber() && right.isNumber()) {
+            if (left.isDouble() || right.isDouble()) {
+                return (left.toDouble() > right.toDouble()) - (left.toDouble() < right.toDouble());
+            }
+            return (left.asInt() > right.asInt()) - (left.asInt() < right.asInt());
+        }
+        return toText(left).compare(toText(right));
+    }
+
+    Value evaluate(const ASTNode& expr) {
+        if (auto numLit = dynamic_cast<const NumberLiteral*>(&expr)) {
+            return Value::number(numLit->value);
+        }
+        if (auto strLit = dynamic_cast<const StringLiteral*>(&expr)) {
+            auto it = literals.find(strLit);
+            if (it == literals.end()) {
+                it = literals.emplace(strLit, strings.string(strLit->value)).first;
+            }
+            return it->second;
+        }
+        if (auto ident = dynamic_cast<const Identifier*>(&expr)) {
+            return environment->get(ident->symbol);
+        }
+        if (auto binOp = dynamic_cast<const BinaryOp*>(&expr)) {
+            Value left = evaluate(*binOp->left);
+            Value right = evaluate(*binOp->right);
+            const std::string& op = binOp->op;
+            if (op == "+") {
+                return add(left, right);
+            }
+            if (op == "-" || op == "*" || op == "/") {
+                return arithmetic(op, left, right);
+            }
+            if (op == "==") {
+                return Value::boolean(valuesEqual(left, right));
+            }
+            if (op == "!=") {
+                return Value::boolean(!valuesEqual(left, right));
+            }
+            if (op == "<" || op == ">" || op == "<=" || op == ">=") {
+                int order = compareValues(left, right);
+                bool result = op == "<" ? order < 0 : op == ">" ? order > 0 : op == "<=" ? order <= 0 : order >= 0;
+                return Value::boolean(result);
+            }
+            if (op == "&&") {
+                return Value::boolean(isTrue(left) && isTrue(right));
+            }
+            if (op == "||") {
+                return Value::boolean(isTrue(left) || isTrue(right));
+            }
+            throw std::runtime_error("Unknown binary operator '" + op + "'.");
+        }
+        if (auto unaryOp = dynamic_cast<const UnaryOp*>(&expr)) {
+            Value operand = evaluate(*unaryOp->operand);
+            if (unaryOp->op == "!") {
+                return Value::boolean(!isTrue(operand));
+            }
+            if (unaryOp->op == "-") {
+                return arithmetic("-", Value::number(0), operand);
+            }
+            throw std::runtime_error("Unknown unary operator '" + unaryOp->op + "'.");
+        }
+        if (auto funcCall = dynamic_cast<const FunctionCall*>(&expr)) {
+            return callFunction(*funcCall);
+        }
+        if (auto list = dynamic_cast<const ListLiteral*>(&expr)) {
+            if (list->reusable) return evaluateReusable(*list);
+            std::vector<Slot> elements;
+            elements.reserve(list->elements.size());
+            for (auto& element : list->elements) {
+                elements.push_back(evaluate(*element));
+            }
+            return Value::object(new ListObject(std::move(elements)));
+        }
+        if (auto index = dynamic_cast<const IndexExpression*>(&expr)) {
+            return evaluateIndex(*index);
+        }
+        throw std::runtime_error("Unknown expression type.");
+    }
+
+    // '&&', '||' and '!' only accept true or "true".
+    static bool isTrue(const Value& value) {
+        if (value.isBool()) return value.asBool();
+        return isKind(value, ObjectKind::String) && stringOf(value) == "true";
+    }
+
+    void defineBuiltIns() {
+        // Interned once for the process rather than by every interpreter.
+        static const std::vector<Symbol> names =
+            internAll({"len", "str", "int", "Channel", "Pipe", "Send", "Transfer", "Receive", "Close", "Summon", "Await",
+                       "SharedSpellBook", "Inscribe", "Increment", "Keys"});
+        for (Symbol name : names) {
+            globals->define(name, Value::object(new BuiltinObject(*name)));
+        }
+    }
+};
+
+// ======================== C++ Backend ========================
+
+// Translates an analyzed Program into C++ source that includes
+// spelllang_runtime.h and builds into a standalone executable:
+//
+//     spelllang_interpreter --emit-cpp program.spell program.cpp
+//     g++ -std=c++17 -O2 -I<spelllang dir> program.cpp -o program
+//
+// Types are inferred per variable: a variable that is only ever assigned
+// integer expressions becomes a spell::Number, everything else a spell::Value.
+// Top-level variables become file-scope globals (looked up by name, as in
+// the interpreter), and variables captured by an Incantation are boxed in a
+// shared_ptr that the closure copies, matching the interpreter's upvalues.
+class CppEmitter {
+public:
+    std::string emit(std::shared_ptr<const Program> program, const std::string& sourceName) {
+        for (auto& stmt : program->statements) {
+            declareGlobal(stmt);
+        }
+        scopes.emplace_back();
+        resolveBlock(program->statements);
+        scopes.pop_back();
+        inferTypes();
+
+        std::string body = emitBlock(program->statements, 1);
+        std::ostringstream out;
+        out << "// Generated by spelllang_interpreter --emit-cpp from " << sourceName << "\n\n";
+        out << "#include \"spelllang_runtime.h\"\n\n";
+        for (auto& entry : globals) {
+            const Symbol& symbol = *entry.second;
+            out << "static " << cppType(symbol.type) << " " << symbol.cppName << (symbol.type == Type::Int ? " = 0;\n" : ";\n");
+        }
+        out << declarations.str() << "\n";
+        out << "static void program() {\n" << body << "}\n\n";
+        out << "int main() {\n    return spell::run(program);\n}\n";
+        return out.str();
+    }
+
+private:
+    enum class Type { Int, Bool, Dynamic };
+
+    struct Symbol {
+        std::string cppName;
+        Type type = Type::Int;
+        bool boxed = false;
+    };
+
+    struct Typed {
+        std::string code;
+        Type type;
+    };
+
+    struct FunctionContext {
+        size_t baseScope;
+    };
+
+    std::map<std::string, std::unique_ptr<Symbol>> globals;
+    std::vector<std::unique_ptr<Symbol>> locals;
+    std::vector<std::unordered_map<std::string, Symbol*>> scopes;
+    std::vector<FunctionContext> functions;
+    // Declaration sites (node, slot) and resolved references.
+    std::map<std::pair<const ASTNode*, size_t>, Symbol*> declared;
+    std::unordered_map<const ASTNode*, Symbol*> resolved;
+    std::vector<std::pair<Symbol*, ASTNodePtr>> assignments;
+    std::ostringstream declarations;
+    int dispatchCount = 0;
+    int boundCount = 0;
+    int itemsCount = 0;
+
+    // ---- Resolution
+
+    void declareGlobal(ASTNodePtr node) {
+        std::string name;
+        if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(node)) name = varDecl->name;
+        else if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) name = funcDecl->name;
+        else if (auto classDecl = std::dynamic_pointer_cast<ClassDeclaration>(node)) name = classDecl->name;
+        else return;
+        auto& symbol = globals[name];
+        if (!symbol) {
+            symbol = std::make_unique<Symbol>();
+            symbol->cppName = "g_" + name;
+        }
+    }
+
+    Symbol* declare(const std::string& name, const ASTNode* site, size_t slot, Type type) {
+        Symbol* symbol;
+        if (scopes.size() == 1) {
+            symbol = globals.at(name).get();
+        }
+        else {
+            locals.push_back(std::make_unique<Symbol>());
+            symbol = locals.back().get();
+            symbol->cppName = "v_" + name + "_" + std::to_string(locals.size());
+            scopes.back()[name] = symbol;
+        }
+        if (type != Type::Int) symbol->type = Type::Dynamic;
+        declared[{site, slot}] = symbol;
+        return symbol;
+    }
+
+    Symbol* lookup(const std::string& name) {
+        for (size_t i = scopes.size(); i-- > 1;) {
+            auto it = scopes[i].find(name);
+            if (it == scopes[i].end()) continue;
+            // Referenced from an Incantation nested inside the declaring scope: an upvalue.
+            if (!functions.empty() && functions.back().baseScope > i) {
+                it->second->boxed = true;
+            }
+            return it->second;
+        }
+        auto global = globals.find(name);
+        return global == globals.end() ? nullptr : global->second.get();
+    }
+
+    void reference(const ASTNode* node, const std::string& name) {
+        resolved[node] = lookup(name);
+    }
+
+    void resolveBlock(const std::vector<ASTNodePtr>& statements) {
+        for (auto& stmt : statements) {
+            resolveNode(stmt);
+        }
+    }
+
+    void resolveScopedBlock(const std::vector<ASTNodePtr>& statements) {
+        scopes.emplace_back();
+        resolveBlock(statements);
+        scopes.pop_back();
+    }
+
+    void resolveNode(ASTNodePtr node) {
+        if (!node) return;
+        if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(node)) {
+            resolveNode(varDecl->value);
+            Symbol* symbol = declare(varDecl->name, node.get(), 0, Type::Int);
+            assignments.emplace_back(symbol, varDecl->value);
+        }
+        else if (auto assign = std::dynamic_pointer_cast<Assignment>(node)) {
+            reference(node.get(), assign->name);
+            resolveNode(assign->value);
+            if (Symbol* symbol = resolved[node.get()]) assignments.emplace_back(symbol, assign->value);
+        }
+        else if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) {
+            declare(funcDecl->name, node.get(), 0, Type::Dynamic);
+            functions.push_back({scopes.size()});
+            scopes.emplace_back();
+            for (size_t i = 0; i < funcDecl->params.size(); ++i) {
+                declare(funcDecl->params[i], node.get(), i + 1, Type::Dynamic);
+            }
+            resolveBlock(funcDecl->body);
+            scopes.pop_back();
+            functions.pop_back();
+        }
+        else if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(node)) {
+            reference(node.get(), funcCall->name);
+            for (auto& arg : funcCall->args) {
+                resolveNode(arg);
+            }
+        }
+        else if (auto printStmt = std::dynamic_pointer_cast<PrintStatement>(node)) {
+            resolveNode(printStmt->expression);
+        }
+        else if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
+            resolveNode(ifStmt->condition);
+            resolveScopedBlock(ifStmt->if_body);
+            resolveScopedBlock(ifStmt->else_body);
+        }
+        else if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
+            resolveNode(whileLoop->condition);
+            resolveScopedBlock(whileLoop->body);
+        }
+        else if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
+            scopes.emplace_back();
+            auto init = std::dynamic_pointer_cast<Assignment>(forLoop->initialization);
+            if (init && !lookup(init->name)) {
+                resolveNode(init->value);
+                Symbol* symbol = declare(init->name, node.get(), 0, Type::Int);
+                assignments.emplace_back(symbol, init->value);
+            }
+            else {
+                resolveNode(forLoop->initialization);
+            }
+            resolveNode(forLoop->condition);
+            resolveScopedBlock(forLoop->body);
+            resolveNode(forLoop->increment);
+            scopes.pop_back();
+        }
+        else if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            resolveNode(forEach->items);
+            scopes.emplace_back();
+            declare(forEach->name, node.get(), 0, Type::Dynamic);
+            resolveScopedBlock(forEach->body);
+            scopes.pop_back();
+        }
+        else if (auto classDecl = std::dynamic_pointer_cast<ClassDeclaration>(node)) {
+            declare(classDecl->name, node.get(), 0, Type::Dynamic);
+        }
+        else if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
+            resolveScopedBlock(tryCatch->try_block);
+            scopes.emplace_back();
+            declare("error", node.get(), 0, Type::Dynamic);
+            resolveBlock(tryCatch->catch_block);
+            scopes.pop_back();
+        }
+        else if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(node)) {
+            resolveNode(binOp->left);
+            resolveNode(binOp->right);
+        }
+        else if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(node)) {
+            resolveNode(unaryOp->operand);
+        }
+        else if (auto ident = std::dynamic_pointer_cast<Identifier>(node)) {
+            reference(node.get(), ident->name);
+        }
+        else if (auto list = std::dynamic_pointer_cast<ListLiteral>(node)) {
+            for (auto& element : list->elements) {
+                resolveNode(element);
+            }
+        }
+        else if (auto index = std::dynamic_pointer_cast<IndexExpression>(node)) {
+            resolveNode(index->object);
+            resolveNode(index->index);
+        }
+    }
+
+    // ---- Type inference
+
+    // Every variable starts as Int and widens to Dynamic as soon as one of
+    // its assignments is not an integer expression; repeat to a fixed point.
+    void inferTypes() {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto& assignment : assignments) {
+                if (assignment.first->type == Type::Int && typeOf(assignment.second) != Type::Int) {
+                    assignment.first->type = Type::Dynamic;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    Type typeOf(ASTNodePtr expr) {
+        if (std::dynamic_pointer_cast<NumberLiteral>(expr)) return Type::Int;
+        if (std::dynamic_pointer_cast<Identifier>(expr)) {
+            Symbol* symbol = resolved[expr.get()];
+            return symbol ? symbol->type : Type::Dynamic;
+        }
+        if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(expr)) {
+            if (binOp->op == "+") {
+                return (typeOf(binOp->left) == Type::Int && typeOf(binOp->right) == Type::Int) ? Type::Int : Type::Dynamic;
+            }
+            if (binOp->op == "-" || binOp->op == "*" || binOp->op == "/") return Type::Int;
+            if (binOp->op == "%") return Type::Dynamic;
+            return Type::Bool;
+        }
+        if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(expr)) {
+            return unaryOp->op == "-" ? Type::Int : Type::Bool;
+        }
+        if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(expr)) {
+            if (isBuiltin(funcCall) && (funcCall->name == "len" || funcCall->name == "int")) return Type::Int;
+        }
+        return Type::Dynamic;
+    }
+
+    bool isBuiltin(std::shared_ptr<FunctionCall> funcCall) {
+        return !resolved[funcCall.get()] && (funcCall->name == "len" || funcCall->name == "str" || funcCall->name == "int");
+    }
+
+    // Builtins for the interpreter's workers and their shared SpellBooks,
+    // which have no counterpart in the single-threaded runtime.
+    static bool isInterpreterOnly(const std::string& name) {
+        return name == "Channel" || name == "Pipe" || name == "Send" || name == "Transfer" || name == "Receive" ||
+               name == "Close" || name == "Summon" || name == "Await" || name == "SharedSpellBook" ||
+               name == "Inscribe" || name == "Increment" || name == "Keys";
+    }
+
+    // ---- Emission
+
+    // Int is spell::Number: a native integer whose arithmetic checks for
+    // overflow and turns into a double, as the interpreter's does.
+    static std::string cppType(Type type) {
+        return type == Type::Int ? "spell::Number" : "spell::Value";
+    }
+
+    static std::string indent(int depth) {
+        return std::string(depth * 4, ' ');
+    }
+
+    static std::string quote(const std::string& text) {
+        std::string result = "\"";
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\') { result += '\\'; result += c; }
+            else if (c == '\n') result += "\\n";
+            else if (c == '\t') result += "\\t";
+            else if (c < 0x20 || c >= 0x7f) {
+                char escape[5];
+                std::snprintf(escape, sizeof(escape), "\\%03o", c);
+                result += escape;
+            }
+            else result += c;
+        }
+        return result + "\"";
+    }
+
+    static std::string read(const Symbol& symbol) {
+        return symbol.boxed ? "(*" + symbol.cppName + ")" : symbol.cppName;
+    }
+
+    static std::string asValue(const Typed& typed) {
+        if (typed.type == Type::Int) return "spell::Value::number(" + typed.code + ")";
+        if (typed.type == Type::Bool) return "spell::Value::boolean(" + typed.code + ")";
+        return typed.code;
+    }
+
+    static std::string asNumber(const Typed& typed) {
+        if (typed.type == Type::Int) return typed.code;
+        return "spell::toNumber(" + asValue(typed) + ")";
+    }
+
+    static std::string asCondition(const Typed& typed) {
+        if (typed.type == Type::Bool) return typed.code;
+        if (typed.type == Type::Int) return "(" + typed.code + " == 1)";
+        return "spell::truthy(" + typed.code + ")";
+    }
+
+    std::string convert(const Typed& typed, Type target) {
+        return target == Type::Int ? asNumber(typed) : asValue(typed);
+    }
+
+    Typed expr(ASTNodePtr node) {
+        if (auto num = std::dynamic_pointer_cast<NumberLiteral>(node)) {
+            return {"spell::Number(" + std::to_string(num->value) + "L)", Type::Int};
+        }
+        if (auto str = std::dynamic_pointer_cast<StringLiteral>(node)) {
+            return {"spell::Value(" + quote(str->value) + ")", Type::Dynamic};
+        }
+        if (std::dynamic_pointer_cast<Identifier>(node)) {
+            Symbol* symbol = resolved[node.get()];
+            if (!symbol) {
+                return {"spell::undefinedVariable(" + quote(std::static_pointer_cast<Identifier>(node)->name) + ")", Type::Dynamic};
+            }
+            return {read(*symbol), symbol->type};
+        }
+        if (auto binOp = std::dynamic_pointer_cast<BinaryOp>(node)) {
+            return binary(binOp);
+        }
+        if (auto unaryOp = std::dynamic_pointer_cast<UnaryOp>(node)) {
+            Typed operand = expr(unaryOp->operand);
+            if (unaryOp->op == "-") return {"(-" + asNumber(operand) + ")", Type::Int};
+            return {"(" + asValue(operand) + ".text() != \"true\")", Type::Bool};
+        }
+        if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(node)) {
+            return call(funcCall);
+        }
+        if (auto list = std::dynamic_pointer_cast<ListLiteral>(node)) {
+            std::string code = "spell::Value::list({";
+            for (size_t i = 0; i < list->elements.size(); ++i) {
+                if (i != 0) code += ", ";
+                code += asValue(expr(list->elements[i]));
+            }
+            return {code + "})", Type::Dynamic};
+        }
+        if (auto index = std::dynamic_pointer_cast<IndexExpression>(node)) {
+            std::string function = index->bounds_checked ? "spell::index(" : "spell::indexUnchecked(";
+            return {function + asValue(expr(index->object)) + ", " + asNumber(expr(index->index)) + ")", Type::Dynamic};
+        }
+        throw std::runtime_error("Cannot compile expression.");
+    }
+
+    Typed binary(std::shared_ptr<BinaryOp> binOp) {
+        Typed left = expr(binOp->left);
+        Typed right = expr(binOp->right);
+        bool ints = left.type == Type::Int && right.type == Type::Int;
+        const std::string& op = binOp->op;
+        if (op == "+") {
+            if (ints) return {"(" + left.code + " + " + right.code + ")", Type::Int};
+            return {"spell::add(" + asValue(left) + ", " + asValue(right) + ")", Type::Dynamic};
+        }
+        if (op == "-" || op == "*") {
+            return {"(" + asNumber(left) + " " + op + " " + asNumber(right) + ")", Type::Int};
+        }
+        if (op == "/") {
+            return {"spell::divide(" + asNumber(left) + ", " + asNumber(right) + ")", Type::Int};
+        }
+        if (op == "==" || op == "!=") {
+            if (ints) return {"(" + left.code + " " + op + " " + right.code + ")", Type::Bool};
+            std::string negate = op == "!=" ? "!" : "";
+            return {negate + "spell::equals(" + asValue(left) + ", " + asValue(right) + ")", Type::Bool};
+        }
+        if (op == "<" || op == ">" || op == "<=" || op == ">=") {
+            if (ints) return {"(" + left.code + " " + op + " " + right.code + ")", Type::Bool};
+            return {"(spell::compare(" + asValue(left) + ", " + asValue(right) + ") " + op + " 0)", Type::Bool};
+        }
+        if (op == "&&") return {"spell::logicalAnd(" + asValue(left) + ", " + asValue(right) + ")", Type::Bool};
+        if (op == "||") return {"spell::logicalOr(" + asValue(left) + ", " + asValue(right) + ")", Type::Bool};
+        return {"spell::unknownOperator(" + quote(op) + ")", Type::Dynamic};
+    }
+
+    Typed call(std::shared_ptr<FunctionCall> funcCall) {
+        if (isBuiltin(funcCall)) {
+            if (funcCall->args.size() != 1) {
+                return {"spell::undefinedCall(" + quote(funcCall->name) + ")", Type::Dynamic};
+            }
+            Typed arg = expr(funcCall->args[0]);
+            if (funcCall->name == "len") return {"spell::len(" + asValue(arg) + ")", Type::Int};
+            if (funcCall->name == "int") return {"spell::Number(" + asNumber(arg) + ".truncated())", Type::Int};
+            return {"spell::Value(spell::str(" + asValue(arg) + "))", Type::Dynamic};
+        }
+        Symbol* symbol = resolved[funcCall.get()];
+        if (!symbol && isInterpreterOnly(funcCall->name)) {
+            throw std::runtime_error("Cannot compile '" + funcCall->name + "': it is only available in the interpreter.");
+        }
+        if (!symbol) {
+            return {"spell::undefinedCall(" + quote(funcCall->name) + ")", Type::Dynamic};
+        }
+        std::string code = "spell::call(" + read(*symbol) + ", " + quote(funcCall->name) + ", {";
+        for (size_t i = 0; i < funcCall->args.size(); ++i) {
+            if (i != 0) code += ", ";
+            code += asValue(expr(funcCall->args[i]));
+        }
+        return {code + "})", Type::Dynamic};
+    }
+
+    std::string emitBlock(const std::vector<ASTNodePtr>& statements, int depth) {
+        std::string code;
+        for (auto& stmt : statements) {
+            code += emitStatement(stmt, depth);
+        }
+        return code;
+    }
+
+    std::string defineLocal(const Symbol& symbol, const std::string& value, int depth) {
+        if (symbol.boxed) {
+            return indent(depth) + "auto " + symbol.cppName + " = std::make_shared<" + cppType(symbol.type) + ">(" + value + ");\n";
+        }
+        return indent(depth) + cppType(symbol.type) + " " + symbol.cppName + " = " + value + ";\n";
+    }
+
+    std::string define(const ASTNode* site, size_t slot, const std::string& value, int depth) {
+        const Symbol& symbol = *declared.at({site, slot});
+        if (symbol.cppName.compare(0, 2, "g_") == 0) {
+            return indent(depth) + symbol.cppName + " = " + value + ";\n";
+        }
+        return defineLocal(symbol, value, depth);
+    }
+
+    std::string emitStatement(ASTNodePtr node, int depth) {
+        std::string pad = indent(depth);
+        if (auto varDecl = std::dynamic_pointer_cast<VarDeclaration>(node)) {
+            const Symbol& symbol = *declared.at({node.get(), 0});
+            return define(node.get(), 0, convert(expr(varDecl->value), symbol.type), depth);
+        }
+        if (auto assign = std::dynamic_pointer_cast<Assignment>(node)) {
+            Symbol* symbol = resolved[node.get()];
+            Typed value = expr(assign->value);
+            if (!symbol) {
+                return pad + "(void)" + asValue(value) + ";\n" + pad + "spell::undefinedVariable(" + quote(assign->name) + ");\n";
+            }
+            return pad + read(*symbol) + " = " + convert(value, symbol->type) + ";\n";
+        }
+        if (auto funcDecl = std::dynamic_pointer_cast<FunctionDeclaration>(node)) {
+            return emitFunction(funcDecl, depth);
+        }
+        if (auto funcCall = std::dynamic_pointer_cast<FunctionCall>(node)) {
+            return pad + call(funcCall).code + ";\n";
+        }
+        if (auto printStmt = std::dynamic_pointer_cast<PrintStatement>(node)) {
+            return pad + "spell::print(" + expr(printStmt->expression).code + ");\n";
+        }
+        if (auto ifStmt = std::dynamic_pointer_cast<IfStatement>(node)) {
+            if (ifStmt->dispatch) return emitDispatch(*ifStmt->dispatch, depth);
+            std::string code = pad + "if (" + asCondition(expr(ifStmt->condition)) + ") {\n";
+            code += emitBlock(ifStmt->if_body, depth + 1);
+            if (!ifStmt->else_body.empty()) {
+                code += pad + "}\n" + pad + "else {\n" + emitBlock(ifStmt->else_body, depth + 1);
+            }
+            return code + pad + "}\n";
+        }
+        if (auto whileLoop = std::dynamic_pointer_cast<WhileLoop>(node)) {
+            return pad + "while (" + asCondition(expr(whileLoop->condition)) + ") {\n" +
+                   emitBlock(whileLoop->body, depth + 1) + pad + "}\n";
+        }
+        if (auto forLoop = std::dynamic_pointer_cast<ForLoop>(node)) {
+            return emitForLoop(forLoop, depth);
+        }
+        if (auto forEach = std::dynamic_pointer_cast<ForEachLoop>(node)) {
+            return emitForEachLoop(forEach, depth);
+        }
+        if (std::dynamic_pointer_cast<ClassDeclaration>(node)) {
+            return define(node.get(), 0, "spell::Value(\"Class\")", depth);
+        }
+        if (auto tryCatch = std::dynamic_pointer_cast<TryCatch>(node)) {
+            std::string code = pad + "try {\n" + emitBlock(tryCatch->try_block, depth + 1) + pad + "}\n";
+            code += pad + "catch (const std::runtime_error& e) {\n";
+            code += define(node.get(), 0, "spell::Value(std::string(e.what()))", depth + 1);
+            return code + emitBlock(tryCatch->catch_block, depth + 1) + pad + "}\n";
+        }
+        return pad + "(void)" + asValue(expr(node)) + ";\n";
+    }
+
+    // Closures copy the boxes of their upvalues; everything else they touch
+    // is a global.
+    std::string emitFunction(std::shared_ptr<FunctionDeclaration> funcDecl, int depth) {
+        std::string pad = indent(depth);
+        const Symbol& symbol = *declared.at({funcDecl.get(), 0});
+        std::string code = define(funcDecl.get(), 0, "spell::Value()", depth);
+        code += pad + read(symbol) + " = spell::Value::function(" + quote(funcDecl->name) + ", " +
+                std::to_string(funcDecl->params.size()) + ", [=](std::vector<spell::Value>& args) {\n";
+        for (size_t i = 0; i < funcDecl->params.size(); ++i) {
+            code += define(funcDecl.get(), i + 1, "args[" + std::to_string(i) + "]", depth + 1);
+        }
+        code += "    " + pad + "(void)args;\n";
+        code += emitBlock(funcDecl->body, depth + 1);
+        return code + pad + "});\n";
+    }
+
+    std::string emitForLoop(std::shared_ptr<ForLoop> forLoop, int depth) {
+        std::string pad = indent(depth);
+        std::string code = pad + "{\n";
+        auto init = std::dynamic_pointer_cast<Assignment>(forLoop->initialization);
+        if (init && declared.count({forLoop.get(), 0})) {
+            const Symbol& symbol = *declared.at({forLoop.get(), 0});
+            code += define(forLoop.get(), 0, convert(expr(init->value), symbol.type), depth + 1);
+        }
+        else {
+            code += emitStatement(forLoop->initialization, depth + 1);
+        }
+        std::string condition;
+        if (forLoop->invariant_bound) {
+            // len() of an unmodified Cauldron is evaluated once.
+            auto cond = std::static_pointer_cast<BinaryOp>(forLoop->condition);
+            std::string bound = "bound_" + std::to_string(boundCount++);
+            code += indent(depth + 1) + "const spell::Number " + bound + " = " + asNumber(expr(cond->right)) + ";\n";
+            condition = asNumber(expr(cond->left)) + " < " + bound;
+        }
+        else {
+            condition = asCondition(expr(forLoop->condition));
+        }
+        code += indent(depth + 1) + "while (" + condition + ") {\n";
+        code += indent(depth + 2) + "{\n" + emitBlock(forLoop->body, depth + 3) + indent(depth + 2) + "}\n";
+        code += emitStatement(forLoop->increment, depth + 2);
+        return code + indent(depth + 1) + "}\n" + pad + "}\n";
+    }
+
+    // Compiled programs run on one thread, so 'Forar Geminio' runs in order;
+    // its reductions then act on the variables directly.
+    std::string emitForEachLoop(std::shared_ptr<ForEachLoop> forEach, int depth) {
+        std::string pad = indent(depth);
+        std::string items = "items_" + std::to_string(itemsCount++);
+        std::string code = pad + "{\n";
+        code += indent(depth + 1) + "const spell::Value " + items + " = " + asValue(expr(forEach->items)) + ";\n";
+        code += indent(depth + 1) + "for (const spell::Value& item : spell::elements(" + items + ")) {\n";
+        code += define(forEach.get(), 0, "item", depth + 2);
+        code += indent(depth + 2) + "{\n" + emitBlock(forEach->body, depth + 3) + indent(depth + 2) + "}\n";
+        return code + indent(depth + 1) + "}\n" + pad + "}\n";
+    }
+
+    // Integer subjects with integer constants switch directly on the value;
+    // everything else goes through a static hash table.
+    std::string emitDispatch(const DispatchTable& table, int depth) {
+        std::string pad = indent(depth);
+        Symbol* symbol = nullptr;
+        if (Symbol* found = lookupResolvedSubject(table)) symbol = found;
+        // Emit cases in chain order so the output is deterministic.
+        std::vector<std::pair<size_t, std::string>> cases;
+        for (auto& entry : table.cases) {
+            cases.emplace_back(entry.second, entry.first);
+        }
+        std::sort(cases.begin(), cases.end());
+        std::string selector;
+        if (symbol && symbol->type == Type::Int && !table.dense.empty()) {
+            selector = read(*symbol) + ".caseKey()";
+        }
+        else {
+            std::string name = "dispatch_" + std::to_string(dispatchCount++);
+            declarations << "static const spell::Dispatch " << name << "{{";
+            bool first = true;
+            for (auto& entry : cases) {
+                declarations << (first ? "" : ", ") << "{" << quote(entry.second) << ", " << entry.first << "}";
+                first = false;
+            }
+            declarations << "}};\n";
+            std::string subject = symbol ? asValue({read(*symbol), symbol->type}) : "spell::undefinedVariable(" + quote(table.subject) + ")";
+            selector = name + ".select(" + subject + ")";
+        }
+        bool direct = symbol && symbol->type == Type::Int && !table.dense.empty();
+        std::string code = pad + "switch (" + selector + ") {\n";
+        for (auto& entry : cases) {
+            std::string label = direct ? entry.second + "L" : std::to_string(entry.first);
+            code += pad + "case " + label + ": {\n" + emitBlock(table.links[entry.first]->if_body, depth + 1) + pad + "    break;\n" + pad + "}\n";
+        }
+        code += pad + "default: {\n" + emitBlock(table.fallback()->else_body, depth + 1) + pad + "}\n";
+        return code + pad + "}\n";
+    }
+
+    // The subject is an Identifier inside the head's condition.
+    Symbol* lookupResolvedSubject(const DispatchTable& table) {
+        auto binOp = std::static_pointer_cast<BinaryOp>(table.links.front()->condition);
+        auto ident = std::dynamic_pointer_cast<Identifier>(binOp->left);
+        ASTNodePtr node = ident ? binOp->left : binOp->right;
+        return resolved[node.get()];
+    }
+};
+
+// ======================== Language Server ========================
+
+// A JSON value; as much of JSON as the language server protocol needs.
+class Json {
+public:
+    enum class Kind { Null, Bool, Number, String, Array, Object };
+
+    Kind kind = Kind::Null;
+    bool boolean = false;
+    double number = 0;
+    // Set for a number spelled as an integer that fits 64 bits, which a
+    // double may not hold exactly.
+    bool isInteger = false;
+    long long integer = 0;
+    std::string string;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> members;
+
+    Json() = default;
+    Json(bool value) : kind(Kind::Bool), boolean(value) {}
+    Json(double value) : kind(Kind::Number), number(value) {}
+    Json(int value) : Json(static_cast<double>(value)) {}
+    Json(unsigned value) : Json(static_cast<double>(value)) {}
+    Json(std::string value) : kind(Kind::String), string(std::move(value)) {}
+    Json(const char* value) : Json(std::string(value)) {}
+
+    static Json list(std::vector<Json> items = {}) {
+        Json json;
+        json.kind = Kind::Array;
+        json.items = std::move(items);
+        return json;
+    }
+
+    static Json object() {
+        Json json;
+        json.kind = Kind::Object;
+        return json;
+    }
+
+    bool isNull() const {
+        return kind == Kind::Null;
+    }
+
+    // The member named 'key', or null.
+    const Json& operator[](std::string_view key) const {
+        static const Json null;
+        for (auto& member : members) {
+            if (member.first == key) return member.second;
+        }
+        return null;
+    }
+
+    Json& set(std::string key, Json value) {
+        members.emplace_back(std::move(key), std::move(value));
+        return *this;
+    }
+
+    int asInt() const {
+        return static_cast<int>(number);
+    }
+
+    static Json parse(std::string_view text) {
+        size_t pos = 0;
+        Json json = parseValue(text, pos);
+        skipSpace(text, pos);
+        if (pos != text.size()) throw std::runtime_error("Malformed JSON.");
+        return json;
+    }
+
+    std::string dump() const {
+        std::string out;
+        dump(out);
+        return out;
+    }
+
+private:
+    void dump(std::string& out) const {
+        switch (kind) {
+        case Kind::Null: out += "null"; break;
+        case Kind::Bool: out += boolean ? "true" : "false"; break;
+        case Kind::Number:
+            out += number == static_cast<long long>(number) ? formatInteger(static_cast<long long>(number)) : formatDouble(number);
+            break;
+        case Kind::String: quote(string, out); break;
+        case Kind::Array:
+            out += '[';
+            for (size_t i = 0; i < items.size(); ++i) {
+                if (i != 0) out += ',';
+                items[i].dump(out);
+            }
+            out += ']';
+            break;
+        case Kind::Object:
+            out += '{';
+            for (size_t i = 0; i < members.size(); ++i) {
+                if (i != 0) out += ',';
+                quote(members[i].first, out);
+                out += ':';
+                members[i].second.dump(out);
+            }
+            out += '}';
+            break;
+        }
+    }
+
+    static void quote(const std::string& text, std::string& out) {
+        out += '"';
+        for (char c : text) {
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escape[8];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    out += escape;
+                }
+                else {
+                    out += c;
+                }
+            }
+        }
+        out += '"';
+    }
+
+    static void skipSpace(std::string_view text, size_t& pos) {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+    }
+
+    static void expect(std::string_view text, size_t& pos, std::string_view word) {
+        if (text.substr(pos, word.size()) != word) throw std::runtime_error("Malformed JSON.");
+        pos += word.size();
+    }
+
+    static Json parseValue(std::string_view text, size_t& pos) {
+        skipSpace(text, pos);
+        if (pos == text.size()) throw std::runtime_error("Malformed JSON.");
+        char c = text[pos];
+        if (c == '{') {
+            Json json = object();
+            ++pos;
+            skipSpace(text, pos);
+            if (pos < text.size() && text[pos] == '}') {
+                ++pos;
+                return json;
+            }
+            for (;;) {
+                skipSpace(text, pos);
+                if (pos == text.size() || text[pos] != '"') throw std::runtime_error("Malformed JSON.");
+                std::string key = parseString(text, pos);
+                skipSpace(text, pos);
+                expect(text, pos, ":");
+                json.set(std::move(key), parseValue(text, pos));
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                expect(text, pos, "}");
+                return json;
+            }
+        }
+        if (c == '[') {
+            Json json = list();
+            ++pos;
+            skipSpace(text, pos);
+            if (pos < text.size() && text[pos] == ']') {
+                ++pos;
+                return json;
+            }
+            for (;;) {
+                json.items.push_back(parseValue(text, pos));
+                skipSpace(text, pos);
+                if (pos < text.size() && text[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                expect(text, pos, "]");
+                return json;
+            }
+        }
+        if (c == '"') return Json(parseString(text, pos));
+        if (c == 't') {
+            expect(text, pos, "true");
+            return Json(true);
+        }
+        if (c == 'f') {
+            expect(text, pos, "false");
+            return Json(false);
+        }
+        if (c == 'n') {
+            expect(text, pos, "null");
+            return Json();
+        }
+        double number;
+        auto parsed = std::from_chars(text.data() + pos, text.data() + text.size(), number);
+        if (parsed.ec != std::errc()) throw std::runtime_error("Malformed JSON.");
+        Json json(number);
+        long long integer;
+        auto whole = std::from_chars(text.data() + pos, parsed.ptr, integer);
+        if (whole.ec == std::errc() && whole.ptr == parsed.ptr) {
+            json.isInteger = true;
+            json.integer = integer;
+        }
+        pos = parsed.ptr - text.data();
+        return json;
+    }
+
+    static std::string parseString(std::string_view text, size_t& pos) {
+        std::string result;
+        ++pos;
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c != '\\') {
+                result += c;
+                continue;
+            }
+            if (pos == text.size()) break;
+            char escape = text[pos++];
+            switch (escape) {
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 't': result += '\t'; break;
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'u': {
+                uint32_t code = parseHex(text, pos);
+                if (code >= 0xD800 && code < 0xDC00 && text.substr(pos, 2) == "\\u") {
+                    pos += 2;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (parseHex(text, pos) - 0xDC00);
+                }
+                appendUtf8(code, result);
+                break;
+            }
+            default: result += escape;
+            }
+        }
+        expect(text, pos, "\"");
+        return result;
     }
 
-    void defineBuiltIns() {
-        globals->define("len", "Builtin");
-        globals->define("str", "Builtin");
-        globals->define("int", "Builtin");
+    static uint32_t parseHex(std::string_view text, size_t& pos) {
+        uint32_t code = 0;
+        auto parsed = std::from_chars(text.data() + pos, text.data() + std::min(text.size(), pos + 4), code, 16);
+        if (parsed.ec != std::errc() || parsed.ptr != text.data() + pos + 4) throw std::runtime_error("Malformed JSON.");
+        pos += 4;
+        return code;
+    }
+
+    static void appendUtf8(uint32_t code, std::string& out) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        }
+        else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+};
+
+enum class SymbolKind { Incantation, Creature, Wand, Parameter };
+
+struct SymbolDefinition {
+    Symbol name;
+    SymbolKind kind;
+    // Offset of the defining node, as parsed.
+    uint32_t offset;
+};
+
+// The definitions in one top-level statement. Those made at top level are
+// visible throughout the document, the rest only inside the statement.
+struct StatementSymbols {
+    std::vector<SymbolDefinition> globals;
+    std::vector<SymbolDefinition> locals;
+};
+
+class SymbolCollector {
+public:
+    static std::shared_ptr<const StatementSymbols> collect(const ASTNode& statement) {
+        auto symbols = std::make_shared<StatementSymbols>();
+        SymbolCollector collector{*symbols};
+        collector.visit(statement, true);
+        return symbols;
+    }
+
+private:
+    StatementSymbols& symbols;
+
+    explicit SymbolCollector(StatementSymbols& symbols) : symbols(symbols) {}
+
+    void define(Symbol name, SymbolKind kind, uint32_t offset, bool global) {
+        (global ? symbols.globals : symbols.locals).push_back({name, kind, offset});
+    }
+
+    void visitBlock(const std::vector<ASTNodePtr>& block) {
+        for (auto& stmt : block) {
+            if (stmt) visit(*stmt, false);
+        }
+    }
+
+    void visit(const ASTNode& node, bool global) {
+        if (auto varDecl = dynamic_cast<const VarDeclaration*>(&node)) {
+            define(varDecl->symbol, SymbolKind::Wand, varDecl->offset, global);
+        }
+        else if (auto funcDecl = dynamic_cast<const FunctionDeclaration*>(&node)) {
+            define(funcDecl->symbol, SymbolKind::Incantation, funcDecl->offset, global);
+            for (Symbol param : funcDecl->paramSymbols) define(param, SymbolKind::Parameter, funcDecl->offset, false);
+            visitBlock(funcDecl->body);
+        }
+        else if (auto classDecl = dynamic_cast<const ClassDeclaration*>(&node)) {
+            define(classDecl->symbol, SymbolKind::Creature, classDecl->offset, global);
+            for (Symbol param : classDecl->paramSymbols) define(param, SymbolKind::Parameter, classDecl->offset, false);
+            visitBlock(classDecl->body);
+        }
+        else if (auto ifStmt = dynamic_cast<const IfStatement*>(&node)) {
+            visitBlock(ifStmt->if_body);
+            visitBlock(ifStmt->else_body);
+        }
+        else if (auto whileLoop = dynamic_cast<const WhileLoop*>(&node)) {
+            visitBlock(whileLoop->body);
+        }
+        else if (auto forLoop = dynamic_cast<const ForLoop*>(&node)) {
+            if (forLoop->initialization) visit(*forLoop->initialization, false);
+            visitBlock(forLoop->body);
+        }
+        else if (auto forEach = dynamic_cast<const ForEachLoop*>(&node)) {
+            define(forEach->symbol, SymbolKind::Wand, forEach->offset, false);
+            visitBlock(forEach->body);
+        }
+        else if (auto tryCatch = dynamic_cast<const TryCatch*>(&node)) {
+            visitBlock(tryCatch->try_block);
+            visitBlock(tryCatch->catch_block);
+        }
+    }
+};
+
+// A snapshot of one document's definitions at one version.
+struct SymbolIndex {
+    struct Statement {
+        uint32_t begin;
+        uint32_t end;
+        // Add to a definition's offset for its place in the current text.
+        int64_t shift;
+        ASTNodePtr node;
+        std::shared_ptr<const StatementSymbols> symbols;
+    };
+
+    uint64_t version = 0;
+    // The document's table, which the statements' Symbols point into.
+    std::shared_ptr<const SymbolTable> names;
+    std::vector<Statement> statements;
+    // Top-level definitions by name, at current offsets, in document order.
+    std::unordered_map<std::string_view, std::vector<std::pair<SymbolKind, uint32_t>>> globals;
+
+    // The top-level statement containing 'offset', or null.
+    const Statement* statementAt(uint32_t offset) const {
+        auto next = std::upper_bound(statements.begin(), statements.end(), offset,
+                                     [](uint32_t value, const Statement& stmt) { return value < stmt.begin; });
+        if (next == statements.begin() || (next - 1)->end < offset) return nullptr;
+        return &*(next - 1);
+    }
+};
+
+// Serves the language server protocol over stdio: diagnostics, go-to-definition
+// and completion. Open documents stay parsed and are reparsed incrementally on
+// each change, which also yields the diagnostics. Symbols are indexed on a
+// background thread per top-level statement, and statements the edit did not
+// touch keep their entries, so the index catches up within the change's cost.
+// Queries wait for the index of the version they are about.
+class LanguageServer {
+public:
+    int run(std::istream& in, std::ostream& out) {
+        output = &out;
+        indexer = std::thread([this] { indexLoop(); });
+        bool shutdown = false;
+        int status = 1;
+        std::string message;
+        while (readMessage(in, message)) {
+            Json request;
+            try {
+                request = Json::parse(message);
+            }
+            catch (const std::runtime_error& e) {
+                replyError(Json(), -32700, e.what());
+                continue;
+            }
+            const std::string& method = request["method"].string;
+            const Json& id = request["id"];
+            const Json& params = request["params"];
+            if (method == "exit") {
+                status = shutdown ? 0 : 1;
+                break;
+            }
+            try {
+                if (method == "initialize") reply(id, capabilities());
+                else if (method == "shutdown") {
+                    shutdown = true;
+                    reply(id, Json());
+                }
+                else if (method == "textDocument/didOpen") open(params);
+                else if (method == "textDocument/didChange") change(params);
+                else if (method == "textDocument/didClose") close(params);
+                else if (method == "textDocument/definition") reply(id, definition(params));
+                else if (method == "textDocument/completion") reply(id, completion(params));
+                else if (!id.isNull()) replyError(id, -32601, "Unknown method '" + method + "'.");
+            }
+            catch (const std::runtime_error& e) {
+                if (!id.isNull()) replyError(id, -32603, e.what());
+                else std::cerr << e.what() << std::endl;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        indexer.join();
+        return status;
+    }
+
+private:
+    struct OpenDocument {
+        Document document;
+        // Counts applied changes; the index is current when its version matches.
+        uint64_t version = 0;
+        std::shared_ptr<const SymbolIndex> index;
+    };
+
+    // A definition at its current offset.
+    struct SymbolSpot {
+        SymbolKind kind;
+        uint32_t offset;
+    };
+
+    // Indexing-thread state: symbols by statement node, per document. They
+    // are reused only while the document keeps the same table, which a
+    // reopened document does not.
+    struct SymbolCache {
+        std::shared_ptr<const SymbolTable> names;
+        std::unordered_map<const ASTNode*, std::shared_ptr<const StatementSymbols>> statements;
+    };
+
+    // Statements past this many unindexed ones are collected in parallel.
+    static constexpr size_t kParallelThreshold = 4096;
+
+    std::ostream* output = nullptr;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable indexed;
+    std::map<std::string, OpenDocument> documents;
+    std::deque<std::string> pending;
+    bool stopping = false;
+    std::thread indexer;
+    std::unordered_map<std::string, SymbolCache> caches;
+
+    static bool readMessage(std::istream& in, std::string& message) {
+        size_t length = 0;
+        bool sized = false;
+        std::string header;
+        while (std::getline(in, header)) {
+            if (!header.empty() && header.back() == '\r') header.pop_back();
+            if (header.empty()) {
+                if (!sized) continue;
+                message.resize(length);
+                return static_cast<bool>(in.read(&message[0], length));
+            }
+            std::string_view field(header);
+            if (field.substr(0, 15) == "Content-Length:") {
+                field.remove_prefix(15);
+                while (!field.empty() && field.front() == ' ') field.remove_prefix(1);
+                sized = std::from_chars(field.data(), field.data() + field.size(), length).ec == std::errc();
+            }
+        }
+        return false;
+    }
+
+    void send(const Json& message) {
+        std::string body = message.dump();
+        *output << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+        output->flush();
+    }
+
+    void reply(const Json& id, Json result) {
+        Json message = Json::object();
+        message.set("jsonrpc", "2.0").set("id", id).set("result", std::move(result));
+        send(message);
+    }
+
+    void replyError(const Json& id, int code, const std::string& text) {
+        Json error = Json::object();
+        error.set("code", code).set("message", text);
+        Json message = Json::object();
+        message.set("jsonrpc", "2.0").set("id", id).set("error", std::move(error));
+        send(message);
+    }
+
+    static Json capabilities() {
+        Json sync = Json::object();
+        sync.set("openClose", true).set("change", 2);
+        Json server = Json::object();
+        server.set("textDocumentSync", std::move(sync))
+            .set("definitionProvider", true)
+            .set("completionProvider", Json::object());
+        Json info = Json::object();
+        info.set("name", "spelllang");
+        Json result = Json::object();
+        result.set("capabilities", std::move(server)).set("serverInfo", std::move(info));
+        return result;
+    }
+
+    // ---------------- Positions ----------------
+
+    // LSP positions are a line and a count of UTF-16 code units within it.
+    static uint32_t offsetOf(const std::string& text, const Json& position) {
+        size_t offset = 0;
+        for (int line = position["line"].asInt(); line > 0; --line) {
+            size_t newline = text.find('\n', offset);
+            if (newline == std::string::npos) return static_cast<uint32_t>(text.size());
+            offset = newline + 1;
+        }
+        for (int units = position["character"].asInt(); units > 0 && offset < text.size() && text[offset] != '\n';) {
+            size_t width = utf8Width(text[offset]);
+            units -= width == 4 ? 2 : 1;
+            offset = std::min(text.size(), offset + width);
+        }
+        return static_cast<uint32_t>(offset);
+    }
+
+    static Json positionOf(const std::string& text, uint32_t offset) {
+        int line = 0;
+        size_t lineStart = 0;
+        for (const char* p = text.data(); (p = static_cast<const char*>(std::memchr(p, '\n', text.data() + offset - p)));) {
+            ++line;
+            lineStart = ++p - text.data();
+        }
+        int character = 0;
+        for (size_t i = lineStart; i < offset; i += utf8Width(text[i])) {
+            character += utf8Width(text[i]) == 4 ? 2 : 1;
+        }
+        Json position = Json::object();
+        position.set("line", line).set("character", character);
+        return position;
+    }
+
+    static size_t utf8Width(char lead) {
+        unsigned char c = static_cast<unsigned char>(lead);
+        return c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+    }
+
+    static Json rangeOf(const std::string& text, uint32_t begin, uint32_t end) {
+        Json range = Json::object();
+        range.set("start", positionOf(text, begin)).set("end", positionOf(text, end));
+        return range;
+    }
+
+    static bool isWordChar(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    // ---------------- Documents ----------------
+
+    void open(const Json& params) {
+        const Json& item = params["textDocument"];
+        std::lock_guard<std::mutex> lock(mutex);
+        OpenDocument& doc = documents[item["uri"].string];
+        doc.document = Document();
+        doc.index.reset();
+        updated(item["uri"].string, doc, apply(doc, {0, 0, item["text"].string}));
+    }
+
+    void change(const Json& params) {
+        const std::string& uri = params["textDocument"]["uri"].string;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = documents.find(uri);
+        if (it == documents.end()) return;
+        OpenDocument& doc = it->second;
+        Json diagnostics = Json::list();
+        for (auto& change : params["contentChanges"].items) {
+            // Each range refers to the text left by the changes before it.
+            const std::string& text = doc.document.text();
+            const Json& range = change["range"];
+            uint32_t begin = range.isNull() ? 0 : offsetOf(text, range["start"]);
+            uint32_t end = range.isNull() ? static_cast<uint32_t>(text.size()) : std::max(begin, offsetOf(text, range["end"]));
+            diagnostics = apply(doc, {begin, end - begin, change["text"].string});
+        }
+        updated(uri, doc, std::move(diagnostics));
+    }
+
+    void close(const Json& params) {
+        const std::string& uri = params["textDocument"]["uri"].string;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            documents.erase(uri);
+            pending.push_back(uri);
+        }
+        queued.notify_one();
+        publish(uri, Json::list());
+    }
+
+    // Applies the edit; returns the document's diagnostics.
+    static Json apply(OpenDocument& doc, const TextEdit& edit) {
+        Json diagnostics = Json::list();
+        try {
+            doc.document.apply(edit);
+        }
+        catch (const SyntaxError& e) {
+            const std::string& text = doc.document.text();
+            uint32_t end = e.offset;
+            while (end < text.size() && isWordChar(text[end])) ++end;
+            end = std::max(end, std::min(e.offset + 1, static_cast<uint32_t>(text.size())));
+            Json diagnostic = Json::object();
+            diagnostic.set("range", rangeOf(text, e.offset, end))
+                .set("severity", 1)
+                .set("source", "spelllang")
+                .set("message", e.what());
+            diagnostics.items.push_back(std::move(diagnostic));
+        }
+        return diagnostics;
+    }
+
+    // Publishes the diagnostics and queues the reindex. Called with the lock held.
+    void updated(const std::string& uri, OpenDocument& doc, Json diagnostics) {
+        ++doc.version;
+        if (std::find(pending.begin(), pending.end(), uri) == pending.end()) pending.push_back(uri);
+        queued.notify_one();
+        publish(uri, std::move(diagnostics));
+    }
+
+    void publish(const std::string& uri, Json diagnostics) {
+        Json params = Json::object();
+        params.set("uri", uri).set("diagnostics", std::move(diagnostics));
+        Json message = Json::object();
+        message.set("jsonrpc", "2.0").set("method", "textDocument/publishDiagnostics").set("params", std::move(params));
+        send(message);
+    }
+
+    // ---------------- Indexing ----------------
+
+    void indexLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            queued.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (stopping) return;
+            std::string uri = pending.front();
+            pending.pop_front();
+            auto it = documents.find(uri);
+            if (it == documents.end()) {
+                caches.erase(uri);
+                continue;
+            }
+            uint64_t version = it->second.version;
+            std::vector<Document::Segment> segments = it->second.document.statements();
+            std::shared_ptr<const SymbolTable> names = it->second.document.symbols();
+            lock.unlock();
+            auto index = buildIndex(caches[uri], segments, std::move(names));
+            index->version = version;
+            lock.lock();
+            it = documents.find(uri);
+            if (it != documents.end() && it->second.version == version) it->second.index = std::move(index);
+            indexed.notify_all();
+        }
+    }
+
+    static std::shared_ptr<SymbolIndex> buildIndex(SymbolCache& cache, const std::vector<Document::Segment>& segments,
+                                                   std::shared_ptr<const SymbolTable> names) {
+        auto index = std::make_shared<SymbolIndex>();
+        index->names = names;
+        index->statements.reserve(segments.size());
+        std::vector<size_t> missing;
+        if (cache.names != names) cache.statements.clear();
+        SymbolCache next{std::move(names), {}};
+        next.statements.reserve(segments.size());
+        for (auto& segment : segments) {
+            auto found = cache.statements.find(segment.statement.get());
+            std::shared_ptr<const StatementSymbols> symbols;
+            if (found != cache.statements.end()) symbols = found->second;
+            else missing.push_back(index->statements.size());
+            index->statements.push_back({segment.begin, segment.end, int64_t(segment.begin) - segment.parsedAt,
+                                         segment.statement, std::move(symbols)});
+        }
+        unsigned workers = missing.size() >= kParallelThreshold ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+        parallelFor(missing.size(), workers, [&](size_t i, unsigned) {
+            auto& stmt = index->statements[missing[i]];
+            stmt.symbols = SymbolCollector::collect(*stmt.node);
+        });
+        // The index holds the nodes, so their addresses stay unique keys.
+        for (auto& stmt : index->statements) {
+            next.statements.emplace(stmt.node.get(), stmt.symbols);
+            for (auto& def : stmt.symbols->globals) {
+                index->globals[*def.name].emplace_back(def.kind, static_cast<uint32_t>(def.offset + stmt.shift));
+            }
+        }
+        cache = std::move(next);
+        return index;
+    }
+
+    // Waits for the index of the document's current version. Called with the
+    // lock held; null when the document is not open.
+    std::shared_ptr<const SymbolIndex> currentIndex(std::unique_lock<std::mutex>& lock, const std::string& uri) {
+        std::shared_ptr<const SymbolIndex> index;
+        indexed.wait(lock, [&] {
+            auto it = documents.find(uri);
+            if (it == documents.end()) return true;
+            index = it->second.index;
+            return index && index->version == it->second.version;
+        });
+        return documents.count(uri) ? index : nullptr;
+    }
+
+    // ---------------- Queries ----------------
+
+    Json definition(const Json& params) {
+        const std::string& uri = params["textDocument"]["uri"].string;
+        std::unique_lock<std::mutex> lock(mutex);
+        auto index = currentIndex(lock, uri);
+        if (!index) return Json();
+        const std::string& text = documents.at(uri).document.text();
+        uint32_t offset = offsetOf(text, params["position"]);
+        uint32_t begin = offset;
+        uint32_t end = offset;
+        while (begin > 0 && isWordChar(text[begin - 1])) --begin;
+        while (end < text.size() && isWordChar(text[end])) ++end;
+        if (begin == end) return Json();
+        std::string_view name(text.data() + begin, end - begin);
+
+        // The closest definition before the use inside its statement, else
+        // the first top-level one.
+        SymbolSpot spot{};
+        bool found = false;
+        if (const SymbolIndex::Statement* stmt = index->statementAt(begin)) {
+            for (auto& def : stmt->symbols->locals) {
+                uint32_t at = static_cast<uint32_t>(def.offset + stmt->shift);
+                if (*def.name != name || at > begin || (found && at < spot.offset)) continue;
+                spot = {def.kind, at};
+                found = true;
+            }
+        }
+        if (!found) {
+            auto global = index->globals.find(name);
+            if (global == index->globals.end()) return Json();
+            spot = {global->second.front().first, global->second.front().second};
+        }
+        uint32_t at = nameOffset(text, name, spot);
+        Json location = Json::object();
+        location.set("uri", uri).set("range", rangeOf(text, at, at + static_cast<uint32_t>(name.size())));
+        return location;
+    }
+
+    Json completion(const Json& params) {
+        const std::string& uri = params["textDocument"]["uri"].string;
+        std::unique_lock<std::mutex> lock(mutex);
+        auto index = currentIndex(lock, uri);
+        Json items = Json::list();
+        if (!index) return items;
+        const std::string& text = documents.at(uri).document.text();
+        uint32_t offset = offsetOf(text, params["position"]);
+        uint32_t begin = offset;
+        while (begin > 0 && isWordChar(text[begin - 1])) --begin;
+        std::string_view prefix(text.data() + begin, offset - begin);
+
+        std::unordered_set<std::string_view> seen;
+        auto add = [&](std::string_view name, int kind) {
+            if (name.substr(0, prefix.size()) != prefix || !seen.insert(name).second) return;
+            Json item = Json::object();
+            item.set("label", std::string(name)).set("kind", kind);
+            items.items.push_back(std::move(item));
+        };
+        if (const SymbolIndex::Statement* stmt = index->statementAt(begin)) {
+            for (auto& def : stmt->symbols->locals) add(*def.name, completionKind(def.kind));
+        }
+        for (auto& entry : index->globals) add(entry.first, completionKind(entry.second.front().first));
+        for (auto& keyword : keywords()) add(keyword, 14);
+        return items;
+    }
+
+    // Definitions are recorded at their node; the name itself follows it,
+    // past the '(' for a parameter.
+    static uint32_t nameOffset(const std::string& text, std::string_view name, const SymbolSpot& spot) {
+        size_t from = spot.offset;
+        if (spot.kind == SymbolKind::Parameter) {
+            size_t paren = text.find('(', from);
+            if (paren != std::string::npos) from = paren;
+        }
+        for (size_t at = text.find(name, from); at != std::string::npos; at = text.find(name, at + 1)) {
+            bool startsWord = at == 0 || !isWordChar(text[at - 1]);
+            bool endsWord = at + name.size() == text.size() || !isWordChar(text[at + name.size()]);
+            if (startsWord && endsWord) return static_cast<uint32_t>(at);
+        }
+        return spot.offset;
+    }
+
+    // CompletionItemKind values.
+    static int completionKind(SymbolKind kind) {
+        switch (kind) {
+        case SymbolKind::Incantation: return 3;
+        case SymbolKind::Creature: return 7;
+        default: return 6;
+        }
+    }
+};
+
+// ======================== Daemon ========================
+
+// Compiled programs by path, reused while the file is unchanged. Handlers
+// run the one copy of a program concurrently; see Program. A program, and the
+// names it interned, is freed once its file changes or is removed and the
+// runs still using it finish.
+class ProgramCache {
+public:
+    // Throws the error to report.
+    std::shared_ptr<const Program> get(const std::string& path) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.erase(path);
+            throw std::runtime_error("Error: Cannot open file '" + path + "'.");
+        }
+        Version version{info.st_mtim.tv_sec, info.st_mtim.tv_nsec, info.st_size};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(path);
+            if (it != entries.end() && it->second.version == version) return it->second.program;
+        }
+        std::string code;
+        if (!readSource(path, code)) throw std::runtime_error("Error: Cannot open file '" + path + "'.");
+        std::shared_ptr<const Program> program = compile(code);
+        std::lock_guard<std::mutex> lock(mutex);
+        entries[path] = Entry{version, program};
+        return program;
+    }
+
+private:
+    struct Version {
+        int64_t seconds;
+        int64_t nanoseconds;
+        int64_t size;
+        bool operator==(const Version& other) const {
+            return seconds == other.seconds && nanoseconds == other.nanoseconds && size == other.size;
+        }
+    };
+
+    struct Entry {
+        Version version;
+        std::shared_ptr<const Program> program;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+};
+
+// Runs scripts for spelllang_client over a Unix domain socket, so a short
+// script costs neither a process start nor a parse. A request carries the
+// client's stdout and stderr as descriptors, and a 32-bit length followed by
+// NUL-terminated fields: "1" for ordered output or "0", the script's absolute
+// path, and its arguments. The script prints straight to the client's
+// descriptors; the reply is one byte, the exit status.
+//
+// Each handler thread accepts on the socket itself and keeps an interpreter
+// ready for its next request, so a request only looks up the program and
+// runs it. An interpreter's globals are its script's, so it runs one script
+// and its replacement is made after the reply.
+class Daemon {
+public:
+    explicit Daemon(std::string path) : path(std::move(path)) {}
+
+    int run() {
+#ifdef __linux__
+        std::signal(SIGPIPE, SIG_IGN);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Error: Socket path '" << path << "' is too long." << std::endl;
+            return 1;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str());
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listener, SOMAXCONN) != 0) {
+            std::cerr << "Error: Cannot listen on '" << path << "': " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        unsigned handlers = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < handlers; ++i) {
+            threads.emplace_back([this, listener] { serve(listener); });
+        }
+        for (auto& thread : threads) thread.join();
+        return 0;
+#else
+        std::cerr << "Error: --serve needs Unix domain sockets." << std::endl;
+        return 1;
+#endif
+    }
+
+private:
+    static constexpr uint32_t kMaxRequest = 1 << 20;
+
+    std::string path;
+    ProgramCache cache;
+
+#ifdef __linux__
+    struct Request {
+        int out = -1;
+        int err = -1;
+        bool ordered = false;
+        std::string script;
+        std::vector<std::string> arguments;
+    };
+
+    void serve(int listener) {
+        OutputWriter writer;
+        std::unique_ptr<Interpreter> interpreter;
+        for (;;) {
+            if (!interpreter) interpreter = std::make_unique<Interpreter>(writer);
+            int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0) {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) continue;
+                return;
+            }
+            Request request;
+            if (receive(connection, request)) {
+                writer.redirect(request.out, request.err, request.ordered);
+                uint8_t status = runScript(*interpreter, request, writer);
+                // Everything the script printed is out before the client returns.
+                interpreter.reset();
+                writer.drain();
+                send(connection, &status, 1, MSG_NOSIGNAL);
+            }
+            close(connection);
+            if (request.out >= 0) close(request.out);
+            if (request.err >= 0) close(request.err);
+        }
+    }
+
+    uint8_t runScript(Interpreter& interpreter, const Request& request, OutputWriter& writer) {
+        std::shared_ptr<const Program> program;
+        try {
+            program = cache.get(request.script);
+        }
+        catch (const std::runtime_error& e) {
+            writer.error(e.what());
+            return 1;
+        }
+        interpreter.bindArguments(request.arguments);
+        interpreter.interpret(program);
+        return 0;
+    }
+
+    static bool receive(int connection, Request& request) {
+        uint32_t length;
+        alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))];
+        iovec io{&length, sizeof(length)};
+        msghdr header{};
+        header.msg_iov = &io;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+        ssize_t received = recvmsg(connection, &header, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+        cmsghdr* rights = CMSG_FIRSTHDR(&header);
+        if (rights && rights->cmsg_level == SOL_SOCKET && rights->cmsg_type == SCM_RIGHTS) {
+            std::vector<int> fds((rights->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            std::memcpy(fds.data(), CMSG_DATA(rights), fds.size() * sizeof(int));
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (i == 0) request.out = fds[i];
+                else if (i == 1) request.err = fds[i];
+                else close(fds[i]);
+            }
+        }
+        if (received != sizeof(length) || request.err < 0 || length > kMaxRequest) return false;
+        std::string payload(length, '\0');
+        if (length > 0 && recv(connection, &payload[0], length, MSG_WAITALL) != static_cast<ssize_t>(length)) return false;
+        std::vector<std::string> fields;
+        for (size_t begin = 0; begin < payload.size();) {
+            size_t end = payload.find('\0', begin);
+            if (end == std::string::npos) return false;
+            fields.push_back(payload.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        if (fields.size() < 2) return false;
+        request.ordered = fields[0] == "1";
+        request.script = fields[1];
+        request.arguments.assign(fields.begin() + 2, fields.end());
+        return true;
+    }
+#endif
+};
+
+// ======================== Batch Mode ========================
+
+// Runs one program once per record of a JSONL or CSV file. The program is
+// compiled once. Records are read a block at a time and spread over a pool
+// of threads, each keeping one interpreter that runs every record it gets
+// over fresh globals; see Interpreter::runRecord. Output comes out in record
+// order. A record that cannot be read, or whose run fails, reports its error
+// in its place and the batch goes on.
+//
+// A JSONL record is an object on a line of its own, whose members become
+// variables: arrays as Cauldrons and nested objects as their JSON text. A
+// CSV file starts with a header line naming the fields; a field that is a
+// plain integer becomes a number, and any other a string.
+class BatchRunner {
+public:
+    enum class Format { JsonLines, Csv };
+
+    BatchRunner(std::shared_ptr<const Program> program, Format format) : program(std::move(program)), format(format) {}
+
+    void run(std::istream& input) {
+        OutputWriter& writer = OutputWriter::instance();
+        Output output(writer);
+        unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::unique_ptr<Interpreter>> interpreters(workers);
+        std::vector<std::unordered_map<std::string, Symbol>> names(workers);
+        std::string text;
+        if (format == Format::Csv) {
+            if (!readRecord(input, text)) return;
+            SymbolTable::Scope scope(*program->symbols);
+            header = internAll(splitCsv(text));
+        }
+        std::vector<std::string> block;
+        std::vector<Result> results;
+        size_t first = 1;
+        for (;;) {
+            block.clear();
+            while (block.size() < kBlockRecords && readRecord(input, text)) block.push_back(std::move(text));
+            if (block.empty()) break;
+            results.assign(block.size(), Result());
+            stealingFor(block.size(), workers, [&](size_t i, unsigned worker) {
+                Result& result = results[i];
+                std::vector<std::pair<Symbol, Message>> record;
+                try {
+                    record = format == Format::Csv ? csvRecord(block[i]) : jsonRecord(block[i], *program->symbols, names[worker]);
+                }
+                catch (const std::runtime_error& e) {
+                    result.malformed = true;
+                    result.error = e.what();
+                    return;
+                }
+                if (!interpreters[worker]) interpreters[worker] = std::make_unique<Interpreter>(writer);
+                result.output = interpreters[worker]->runRecord(program, std::move(record), result.error);
+            });
+            for (size_t i = 0; i < block.size(); ++i) {
+                output.append(results[i].output);
+                if (results[i].error.empty()) continue;
+                output.error((results[i].malformed ? "Error in record " : "Runtime Error in record ") +
+                             std::to_string(first + i) + ": " + results[i].error);
+            }
+            first += block.size();
+        }
+        output.flush();
+    }
+
+private:
+    // Records read and run at a time; their outputs are held until all are done.
+    static constexpr size_t kBlockRecords = 4096;
+
+    struct Result {
+        std::string output;
+        std::string error;
+        bool malformed = false;
+    };
+
+    std::shared_ptr<const Program> program;
+    Format format;
+    std::vector<Symbol> header;
+
+    // The next record's text, without its line ending. Blank lines are
+    // skipped, and a quoted CSV field may span lines.
+    bool readRecord(std::istream& input, std::string& text) {
+        std::string line;
+        do {
+            if (!std::getline(input, line)) return false;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+        } while (line.find_first_not_of(" \t") == std::string::npos);
+        text = std::move(line);
+        if (format != Format::Csv) return true;
+        while (std::count(text.begin(), text.end(), '"') % 2 != 0 && std::getline(input, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            text += '\n';
+            text += line;
+        }
+        return true;
+    }
+
+    static std::vector<std::string> splitCsv(const std::string& text) {
+        std::vector<std::string> fields(1);
+        bool quoted = false;
+        for (size_t i = 0; i < text.size(); ++i) {
+            char c = text[i];
+            if (quoted) {
+                if (c != '"') fields.back() += c;
+                else if (i + 1 < text.size() && text[i + 1] == '"') fields.back() += text[++i];
+                else quoted = false;
+            }
+            else if (c == '"') quoted = true;
+            else if (c == ',') fields.emplace_back();
+            else fields.back() += c;
+        }
+        return fields;
+    }
+
+    std::vector<std::pair<Symbol, Message>> csvRecord(const std::string& text) const {
+        std::vector<std::string> fields = splitCsv(text);
+        if (fields.size() != header.size()) {
+            throw std::runtime_error("It has " + std::to_string(fields.size()) + " fields but the header names " +
+                                     std::to_string(header.size()) + ".");
+        }
+        std::vector<std::pair<Symbol, Message>> record;
+        record.reserve(fields.size());
+        for (size_t i = 0; i < fields.size(); ++i) {
+            Message message;
+            long number;
+            if (DispatchTable::parseCanonicalInt(fields[i], number)) {
+                message = Message::number(number);
+            }
+            else {
+                message.kind = Message::Kind::String;
+                message.text = std::move(fields[i]);
+            }
+            record.emplace_back(header[i], std::move(message));
+        }
+        return record;
+    }
+
+    static std::vector<std::pair<Symbol, Message>> jsonRecord(const std::string& text, SymbolTable& symbols,
+                                                              std::unordered_map<std::string, Symbol>& names) {
+        Json json = Json::parse(text);
+        if (json.kind != Json::Kind::Object) throw std::runtime_error("A JSONL record must be an object.");
+        std::vector<std::pair<Symbol, Message>> record;
+        record.reserve(json.members.size());
+        for (auto& member : json.members) {
+            // Interned once per thread, not once per record.
+            Symbol& name = names[member.first];
+            if (!name) name = symbols.intern(member.first);
+            record.emplace_back(name, messageOf(member.second));
+        }
+        return record;
+    }
+
+    static Message messageOf(const Json& json) {
+        Message message;
+        switch (json.kind) {
+            case Json::Kind::Null:
+                break;
+            case Json::Kind::Bool:
+                message.immediate = Value::boolean(json.boolean);
+                break;
+            case Json::Kind::Number:
+                if (json.isInteger) {
+                    message = Message::number(json.integer);
+                }
+                else if (json.number == std::trunc(json.number) && std::fabs(json.number) < 0x1p53) {
+                    message = Message::number(static_cast<long long>(json.number));
+                }
+                else {
+                    message.immediate = Value::fromDouble(json.number);
+                }
+                break;
+            case Json::Kind::String:
+                message.kind = Message::Kind::String;
+                message.text = json.string;
+                break;
+            case Json::Kind::Array:
+                message.kind = Message::Kind::Cauldron;
+                for (auto& item : json.items) message.elements.push_back(messageOf(item));
+                break;
+            case Json::Kind::Object:
+                message.kind = Message::Kind::String;
+                message.text = json.dump();
+                break;
+        }
+        return message;
     }
 };
 
 // ======================== Main Function ========================
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: ./spelllang_interpreter <filename.spell>" << std::endl;
+    if (argc == 2 && std::string(argv[1]) == "--lsp") {
+        LanguageServer server;
+        return server.run(std::cin, std::cout);
+    }
+    if (argc == 3 && std::string(argv[1]) == "--serve") {
+        Daemon daemon(argv[2]);
+        return daemon.run();
+    }
+    bool emitCpp = argc == 4 && std::string(argv[1]) == "--emit-cpp";
+    bool batch = argc == 4 && std::string(argv[1]) == "--batch";
+    bool ordered = argc >= 3 && std::string(argv[1]) == "--ordered-output";
+    bool plain = argc >= 2 && std::string(argv[1]).compare(0, 2, "--") != 0;
+    if (!plain && !emitCpp && !batch && !ordered) {
+        std::cerr << "Usage: ./spelllang_interpreter <filename.spell> [arguments...]" << std::endl;
+        std::cerr << "       ./spelllang_interpreter --ordered-output <filename.spell> [arguments...]" << std::endl;
+        std::cerr << "       ./spelllang_interpreter --emit-cpp <filename.spell> <output.cpp>" << std::endl;
+        std::cerr << "       ./spelllang_interpreter --batch <filename.spell> <records.jsonl|records.csv>" << std::endl;
+        std::cerr << "       ./spelllang_interpreter --serve <socket>" << std::endl;
+        std::cerr << "       ./spelllang_interpreter --lsp" << std::endl;
         return 1;
     }
+    int sourceIndex = emitCpp || batch || ordered ? 2 : 1;
+    const char* sourcePath = argv[sourceIndex];
 
-    std::ifstream file(argv[1]);
-    if (!file) {
-        std::cerr << "Error: Cannot open file '" << argv[1] << "'." << std::endl;
+    std::string code;
+    if (!readSource(sourcePath, code)) {
+        std::cerr << "Error: Cannot open file '" << sourcePath << "'." << std::endl;
         return 1;
     }
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string code = buffer.str();
-
-    // Lexing
-    Lexer lexer(code);
-    std::vector<Token> tokens;
+    // Lexing, parsing and analysis
+    std::shared_ptr<const Program> program;
     try {
-        tokens = lexer.tokenize();
+        program = compile(code);
     }
     catch (const std::runtime_error& e) {
         std::cerr << e.what() << std::endl;
         return 1;
     }
 
-    // Parsing
-    Parser parser(tokens);
-    std::shared_ptr<Program> program;
-    try {
-        program = parser.parse();
+    // Ahead-of-time compilation
+    if (emitCpp) {
+        std::ofstream output(argv[3]);
+        if (!output) {
+            std::cerr << "Error: Cannot write file '" << argv[3] << "'." << std::endl;
+            return 1;
+        }
+        try {
+            CppEmitter emitter;
+            output << emitter.emit(program, sourcePath);
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
     }
-    catch (const std::runtime_error& e) {
-        std::cerr << e.what() << std::endl;
-        return 1;
+
+    // Batch execution
+    if (batch) {
+        std::string recordsPath = argv[3];
+        auto endsWith = [&](const std::string& suffix) {
+            return recordsPath.size() >= suffix.size() &&
+                   recordsPath.compare(recordsPath.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+        if (!endsWith(".jsonl") && !endsWith(".csv")) {
+            std::cerr << "Error: Batch records must be a .jsonl or .csv file." << std::endl;
+            return 1;
+        }
+        std::ifstream records(recordsPath);
+        if (!records) {
+            std::cerr << "Error: Cannot open file '" << recordsPath << "'." << std::endl;
+            return 1;
+        }
+        // A record's workers print into its output.
+        OutputWriter::instance().ordered = true;
+        BatchRunner runner(program, endsWith(".csv") ? BatchRunner::Format::Csv : BatchRunner::Format::JsonLines);
+        runner.run(records);
+        return 0;
     }
 
     // Interpretation
+    OutputWriter::instance().ordered = ordered;
     Interpreter interpreter;
+    interpreter.bindArguments(std::vector<std::string>(argv + sourceIndex + 1, argv + argc));
     interpreter.interpret(program);
 
     return 0;
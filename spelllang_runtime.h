@@ -0,0 +1,333 @@
+// spelllang_runtime.h
+//
+// Runtime library for C++ emitted by `spelllang_interpreter --emit-cpp`.
+// Mirrors the interpreter's value semantics so compiled programs print the
+// same output: every value has a text form, integers add and compare
+// numerically and become doubles when 64-bit arithmetic overflows, and
+// conditions are true for "true" or "1".
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <climits>
+#include <stdexcept>
+
+namespace spell {
+
+class Value;
+using List = std::vector<Value>;
+
+// A 64-bit integer, or the double that integer arithmetic overflowing 64
+// bits produces. Once a double, arithmetic on it stays in doubles.
+class Number {
+public:
+    Number(long value = 0) : integer_(value) {}
+
+    static Number fromDouble(double value) {
+        Number number;
+        number.isDouble_ = true;
+        number.double_ = value;
+        return number;
+    }
+
+    bool isDouble() const { return isDouble_; }
+    long integer() const { return integer_; }
+    double toDouble() const { return isDouble_ ? double_ : static_cast<double>(integer_); }
+    // int() of a double drops its fraction.
+    long truncated() const { return isDouble_ ? static_cast<long>(double_) : integer_; }
+
+    // The shortest spelling that reads back as the same number.
+    std::string text() const {
+        char buffer[32];
+        char* end = isDouble_ ? std::to_chars(buffer, buffer + sizeof(buffer), double_).ptr
+                              : std::to_chars(buffer, buffer + sizeof(buffer), integer_).ptr;
+        return std::string(buffer, end);
+    }
+
+    // Switch label for an Ifar/Elsear chain, which matches on the text form:
+    // a double spelled as an integer takes that integer's case. LONG_MIN is
+    // never a case label, so every other double takes the fallback.
+    long caseKey() const {
+        if (!isDouble_) return integer_;
+        std::string spelled = text();
+        long result;
+        auto parsed = std::from_chars(spelled.data(), spelled.data() + spelled.size(), result);
+        return parsed.ec == std::errc() && parsed.ptr == spelled.data() + spelled.size() ? result : LONG_MIN;
+    }
+
+private:
+    long integer_ = 0;
+    double double_ = 0;
+    bool isDouble_ = false;
+};
+
+inline Number operator+(Number left, Number right) {
+    long result;
+    if (!left.isDouble() && !right.isDouble() && !__builtin_add_overflow(left.integer(), right.integer(), &result)) {
+        return result;
+    }
+    return Number::fromDouble(left.toDouble() + right.toDouble());
+}
+
+inline Number operator-(Number left, Number right) {
+    long result;
+    if (!left.isDouble() && !right.isDouble() && !__builtin_sub_overflow(left.integer(), right.integer(), &result)) {
+        return result;
+    }
+    return Number::fromDouble(left.toDouble() - right.toDouble());
+}
+
+inline Number operator*(Number left, Number right) {
+    long result;
+    if (!left.isDouble() && !right.isDouble() && !__builtin_mul_overflow(left.integer(), right.integer(), &result)) {
+        return result;
+    }
+    return Number::fromDouble(left.toDouble() * right.toDouble());
+}
+
+inline Number operator-(Number operand) {
+    return Number(0) - operand;
+}
+
+// Integers compare as integers; once either side is a double, as doubles.
+inline bool operator<(Number left, Number right) {
+    if (left.isDouble() || right.isDouble()) return left.toDouble() < right.toDouble();
+    return left.integer() < right.integer();
+}
+
+inline bool operator>(Number left, Number right) { return right < left; }
+inline bool operator<=(Number left, Number right) { return !(right < left); }
+inline bool operator>=(Number left, Number right) { return !(left < right); }
+
+// '==' compares text forms, as it does for every other value.
+inline bool operator==(Number left, Number right) {
+    if (!left.isDouble() && !right.isDouble()) return left.integer() == right.integer();
+    return left.text() == right.text();
+}
+
+inline bool operator!=(Number left, Number right) { return !(left == right); }
+
+struct Function {
+    std::string name;
+    size_t arity;
+    std::function<void(std::vector<Value>&)> body;
+};
+
+class Value {
+public:
+    Value() = default;
+    Value(std::string text) : text_(std::move(text)) {}
+
+    static Value number(Number value) {
+        Value result(value.text());
+        result.isNumber_ = true;
+        result.number_ = value;
+        return result;
+    }
+    static Value boolean(bool value) { return Value(value ? "true" : "false"); }
+
+    static Value list(List elements) {
+        Value value;
+        value.list_ = std::make_shared<List>(std::move(elements));
+        return value;
+    }
+
+    static Value function(std::string name, size_t arity, std::function<void(std::vector<Value>&)> body) {
+        Value value;
+        value.function_ = std::make_shared<Function>(Function{std::move(name), arity, std::move(body)});
+        return value;
+    }
+
+    const std::string& text() const { return text_; }
+    // Numbers keep their value beside their text: only they add and
+    // compare numerically, not strings spelled like them.
+    bool isNumber() const { return isNumber_; }
+    Number asNumber() const { return number_; }
+    const List* asList() const { return list_.get(); }
+    const Function* asFunction() const { return function_.get(); }
+
+    bool sameObject(const Value& other) const {
+        return (list_ && list_ == other.list_) || (function_ && function_ == other.function_);
+    }
+
+private:
+    std::string text_;
+    std::shared_ptr<List> list_;
+    std::shared_ptr<Function> function_;
+    bool isNumber_ = false;
+    Number number_;
+};
+
+// Whole-string base-10 integer; false for anything else, including overflow.
+inline bool parseInteger(const std::string& text, long& result) {
+    const char* end = text.data() + text.size();
+    auto parsed = std::from_chars(text.data(), end, result);
+    return parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+inline bool isInteger(const std::string& text) {
+    long ignored;
+    return parseInteger(text, ignored);
+}
+
+inline std::string str(const Value& value) {
+    if (const List* list = value.asList()) {
+        std::string result = "[";
+        for (size_t i = 0; i < list->size(); ++i) {
+            if (i != 0) result += ", ";
+            result += str((*list)[i]);
+        }
+        return result + "]";
+    }
+    if (value.asFunction()) return "Function";
+    return value.text();
+}
+
+// The number '-', '*', '/', int() and indexes work with: a number, or a
+// string spelled as an integer.
+inline Number toNumber(const Value& value) {
+    if (value.isNumber()) return value.asNumber();
+    long result;
+    if (value.asList() || value.asFunction() || !parseInteger(value.text(), result)) {
+        throw std::runtime_error("Expected a number but got '" + str(value) + "'.");
+    }
+    return result;
+}
+
+inline Number toNumber(Number value) {
+    return value;
+}
+
+// Numbers add, everything else concatenates.
+inline Value add(const Value& left, const Value& right) {
+    if (left.isNumber() && right.isNumber()) {
+        return Value::number(left.asNumber() + right.asNumber());
+    }
+    return Value(str(left) + str(right));
+}
+
+inline Number divide(Number left, Number right) {
+    if (left.isDouble() || right.isDouble()) {
+        if (right.toDouble() == 0) throw std::runtime_error("Division by zero.");
+        return Number::fromDouble(left.toDouble() / right.toDouble());
+    }
+    if (right.integer() == 0) throw std::runtime_error("Division by zero.");
+    if (right.integer() == -1) return -left;
+    return left.integer() / right.integer();
+}
+
+// Numbers compare numerically, everything else lexicographically.
+inline int compare(const Value& left, const Value& right) {
+    if (left.isNumber() && right.isNumber()) {
+        Number l = left.asNumber(), r = right.asNumber();
+        return (l > r) - (l < r);
+    }
+    return str(left).compare(str(right));
+}
+
+inline bool equals(const Value& left, const Value& right) {
+    if (left.asList() || left.asFunction() || right.asList() || right.asFunction()) {
+        return left.sameObject(right);
+    }
+    return left.text() == right.text();
+}
+
+inline bool truthy(const Value& value) {
+    return value.text() == "true" || value.text() == "1";
+}
+
+inline bool logicalAnd(const Value& left, const Value& right) {
+    return left.text() == "true" && right.text() == "true";
+}
+
+inline bool logicalOr(const Value& left, const Value& right) {
+    return left.text() == "true" || right.text() == "true";
+}
+
+inline Number len(const Value& value) {
+    if (const List* list = value.asList()) return static_cast<long>(list->size());
+    return static_cast<long>(value.text().size());
+}
+
+inline const Value& index(const Value& object, Number position) {
+    long i = position.truncated();
+    const List* list = object.asList();
+    if (!list) throw std::runtime_error("Only a Cauldron can be indexed.");
+    if (i < 0 || static_cast<size_t>(i) >= list->size()) {
+        throw std::runtime_error("Cauldron index " + position.text() + " is out of range.");
+    }
+    return (*list)[i];
+}
+
+inline const List& elements(const Value& items) {
+    const List* list = items.asList();
+    if (!list) throw std::runtime_error("Forar needs a Cauldron but got '" + str(items) + "'.");
+    return *list;
+}
+
+// For indexes the compiler proved to be in range.
+inline const Value& indexUnchecked(const Value& object, Number i) {
+    return (*object.asList())[i.truncated()];
+}
+
+inline void print(const Value& value) { std::cout << str(value) << std::endl; }
+inline void print(Number value) { std::cout << value.text() << std::endl; }
+inline void print(bool value) { std::cout << (value ? "true" : "false") << std::endl; }
+
+inline Value call(const Value& callee, const std::string& name, std::vector<Value> args) {
+    if (const Function* function = callee.asFunction()) {
+        if (args.size() != function->arity) {
+            throw std::runtime_error("Incantation '" + function->name + "' expects " + std::to_string(function->arity) +
+                                     " arguments but got " + std::to_string(args.size()) + ".");
+        }
+        function->body(args);
+    }
+    else {
+        std::cout << "Function call: " << name << std::endl;
+    }
+    return Value("");
+}
+
+inline Value undefinedCall(const std::string& name) {
+    std::cout << "Function '" << name << "' is not defined." << std::endl;
+    return Value("");
+}
+
+[[noreturn]] inline Value undefinedVariable(const std::string& name) {
+    throw std::runtime_error("Undefined variable '" + name + "'.");
+}
+
+[[noreturn]] inline Value unknownOperator(const std::string& op) {
+    throw std::runtime_error("Unknown binary operator '" + op + "'.");
+}
+
+// Compiled Ifar/Elsear chain: maps each constant to its link, -1 for the fallback.
+struct Dispatch {
+    std::unordered_map<std::string, int> cases;
+
+    int select(const Value& subject) const {
+        if (subject.asList() || subject.asFunction()) return -1;
+        auto it = cases.find(subject.text());
+        return it == cases.end() ? -1 : it->second;
+    }
+};
+
+inline int run(void (*program)()) {
+    try {
+        program();
+    }
+    catch (const std::runtime_error& e) {
+        std::cerr << "Runtime Error: " << e.what() << std::endl;
+    }
+    return 0;
+}
+
+} // namespace spell
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Regression tests. Builds the interpreter, with and without
+# -DSPELL_POINTER_COMPRESSION, runs every tests/*.spell on both builds and
+# compares what it prints, stderr included, with the .expected file beside it.
+# Programs in tests/compiled/ are also built with --emit-cpp and must print
+# the same; --emit-cpp must reject those in tests/rejected/ with the error
+# in their .expected file. Each tests/lsp/*.in is a session of framed
+# requests replayed through --lsp.
+#
+#     tests/run.sh
+set -u
+cd "$(dirname "$0")/.."
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+g++ -std=c++17 -O2 -pthread spelllang_interpreter.cpp -o "$work/spell" || exit 1
+g++ -std=c++17 -O2 -pthread -DSPELL_POINTER_COMPRESSION spelllang_interpreter.cpp -o "$work/spell-compressed" || exit 1
+
+failed=0
+check() {
+    if ! "$@" 2>&1 | diff -u "$expected" - > "$work/diff"; then
+        echo "FAIL $program ($label)"
+        cat "$work/diff"
+        failed=1
+    fi
+}
+
+for program in tests/*.spell tests/compiled/*.spell; do
+    expected="${program%.spell}.expected"
+    for label in spell spell-compressed; do
+        check "$work/$label" "$program"
+    done
+    case "$program" in tests/compiled/*)
+        label=emit-cpp
+        if "$work/spell" --emit-cpp "$program" "$work/program.cpp" &&
+           g++ -std=c++17 -O2 -I. "$work/program.cpp" -o "$work/program"; then
+            check "$work/program"
+        else
+            echo "FAIL $program ($label)"
+            failed=1
+        fi
+    esac
+done
+
+for program in tests/rejected/*.spell; do
+    expected="${program%.spell}.expected"
+    label=emit-cpp
+    check "$work/spell" --emit-cpp "$program" "$work/program.cpp"
+done
+
+for session in tests/lsp/*.in; do
+    program="$session"
+    expected="${session%.in}.expected"
+    label=lsp
+    check "$work/spell" --lsp < "$session"
+done
+
+[ "$failed" = 0 ] && echo "All tests passed."
+exit "$failed"